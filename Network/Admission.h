@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "Network/Router.h"
+
+namespace Http {
+/*Admission counts the tasks the Router accepted but did not hand to libcurl yet,
+  Router::Run waits on it or refuses when RouterOptions queue limits are reached.
+  Excutors call Leave as tasks are dispatched, cancelled, timed out or shed.*/
+class Admission {
+public:
+    Admission() : tasks(0), bytes(0), waiters(0), shed(0), rejected(0) {}
+    Admission(const Admission&) = delete;
+    Admission& operator=(const Admission&) = delete;
+
+    //rough heap cost of a pending task, what userData points to is not known
+    static size_t Footprint(Task& task) {
+        size_t size = sizeof(Task) + task.Url().ToString().size();
+        for (auto const& data : task.Uploadeddatas()) {
+            size += sizeof(UploadedData) + data.Key().size() + data.Value().size() + data.FileName().size();
+        }
+        return size;
+    }
+    //take room for a task of size bytes, 0 limits are unlimited.
+    //An empty queue takes any task, so a big one cannot wait forever
+    bool TryEnter(size_t size, size_t maxTasks, size_t maxBytes) {
+        size_t queuedTasks = tasks++;
+        size_t queuedBytes = bytes.fetch_add(size);
+        if (queuedTasks > 0 && ((maxTasks > 0 && queuedTasks + 1 > maxTasks) || (maxBytes > 0 && queuedBytes + size > maxBytes))) {
+            Leave(size);
+            return false;
+        }
+        return true;
+    }
+    //block until TryEnter succeeds
+    void Enter(size_t size, size_t maxTasks, size_t maxBytes) {
+        while (!TryEnter(size, maxTasks, maxBytes)) {
+            //a failed TryEnter notifies as it gives the room back, keep it out of the lock
+            std::unique_lock<std::mutex> lock(mutex);
+            ++waiters;
+            room.wait(lock, [&] { return HasRoom(size, maxTasks, maxBytes); });
+            --waiters;
+        }
+    }
+    //any thread, a task of size bytes left the pending queue
+    void Leave(size_t size) {
+        --tasks;
+        bytes -= size;
+        if (waiters > 0) {
+            Notify();
+        }
+    }
+    //wake blocked submitters, e.g. after the limits were raised
+    void Notify() {
+        std::lock_guard<std::mutex> lock(mutex);
+        room.notify_all();
+    }
+    void Shed() {
+        ++shed;
+    }
+    void Rejected() {
+        ++rejected;
+    }
+    //readable from any thread
+    void Stats(RouterStats& stats) const {
+        stats.queuedTasks = tasks;
+        stats.queuedBytes = bytes;
+        stats.tasksShed = shed;
+        stats.tasksRejected = rejected;
+    }
+private:
+    //what TryEnter would find, without taking anything
+    bool HasRoom(size_t size, size_t maxTasks, size_t maxBytes) const {
+        size_t queuedTasks = tasks;
+        return queuedTasks == 0 || ((maxTasks == 0 || queuedTasks < maxTasks) && (maxBytes == 0 || bytes + size <= maxBytes));
+    }
+private:
+    std::atomic<size_t> tasks;
+    std::atomic<size_t> bytes;
+    std::atomic<int> waiters;
+    std::atomic<unsigned long long> shed;
+    std::atomic<unsigned long long> rejected;
+    std::mutex mutex;
+    std::condition_variable room;
+};
+
+}
@@ -0,0 +1,75 @@
+﻿#include "stdafx.h"
+#include <algorithm>
+#include "Batch.h"
+
+namespace Http {
+
+Batch::Batch(size_t count, size_t needed) : needed(needed), ended(0), outstanding(count), fulfilled(false) {
+    marks.reserve(count);
+    responses.resize(count);
+}
+
+std::future<std::vector<Response> > Batch::Result() {
+    return promise.get_future();
+}
+
+void Batch::Add(long long mark) {
+    marks.push_back(mark);
+}
+
+void Batch::Refused(long long mark, std::vector<long long>& unfinished) {
+    Response* response = new Response();
+    response->Status(Response::DROPPED);
+    response->CurlCode(CURLE_ABORTED_BY_CALLBACK);
+    bool last = Complete(mark, response, unfinished);
+    if (last) {
+        delete this;
+    }
+}
+
+void Batch::Do(const Task& task) {
+    //the task is freed right after Do, its body is taken instead of copied
+    Response* response = new Response(std::move(static_cast<Response&>(const_cast<Task&>(task))));
+    std::vector<long long> unfinished;
+    bool last = Complete(task.Mark(), response, unfinished);
+    for (long long mark : unfinished) {
+        ROUTER.Cancel(mark);
+    }
+    if (last) {
+        delete this;
+    }
+}
+
+int Batch::Progress(double, double, double, double, double, const Task&) {
+    return 0;
+}
+
+bool Batch::Complete(long long mark, Response* response, std::vector<long long>& unfinished) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t index = std::lower_bound(marks.begin(), marks.end(), mark) - marks.begin();
+    if (!fulfilled) {
+        responses[index].reset(response);
+        if (++ended >= needed) {
+            fulfilled = true;
+            std::vector<Response> result;
+            result.reserve(responses.size());
+            for (size_t i = 0; i < responses.size(); ++i) {
+                if (responses[i]) {
+                    result.push_back(std::move(*responses[i]));
+                } else {
+                    unfinished.push_back(marks[i]);
+                    result.push_back(Response());
+                    result.back().Status(Response::CANCELLED);
+                    result.back().CurlCode(CURLE_ABORTED_BY_CALLBACK);
+                }
+            }
+            responses.clear();
+            promise.set_value(std::move(result));
+        }
+    } else {
+        delete response;
+    }
+    return --outstanding == 0;
+}
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <mutex>
+#include <future>
+#include <memory>
+#include <vector>
+#include "Network/Router.h"
+
+namespace Http {
+/*Batch is the shared Action of the tasks of one Router::GetAll. It keeps their
+  responses by position and fulfils the promise once needed of them ended, the
+  others are cancelled then. It frees itself when the last task is done with it.*/
+class Batch : public Action {
+public:
+    Batch(size_t count, size_t needed);
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+    std::future<std::vector<Response> > Result();
+    //tasks are added in submission order, before any of them is submitted
+    void Add(long long mark);
+    //a task the Router did not accept, it ends as Response::DROPPED. If that fulfilled the
+    //promise, unfinished gets the marks the caller cancels once they are all submitted
+    void Refused(long long mark, std::vector<long long>& unfinished);
+    virtual void Do(const Task& task) override;
+    virtual int Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) override;
+private:
+    //record the response of mark, true once nothing refers to the batch any more
+    bool Complete(long long mark, Response* response, std::vector<long long>& unfinished);
+private:
+    std::mutex mutex;
+    //ascending, as marks are taken from a counter
+    std::vector<long long> marks;
+    std::vector<std::unique_ptr<Response> > responses;
+    size_t needed;
+    size_t ended;
+    size_t outstanding;
+    bool fulfilled;
+    std::promise<std::vector<Response> > promise;
+};
+
+}
@@ -0,0 +1,35 @@
+﻿#include "stdafx.h"
+#include <thread>
+#include "CallbackPool.h"
+
+namespace Http {
+
+CallbackPool::CallbackPool(size_t threads) {
+    for (size_t i = 0; i < threads; ++i) {
+        std::thread worker(&CallbackPool::Work, this);
+        worker.detach();
+    }
+}
+
+void CallbackPool::Post(std::function<void()>&& job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    ready.notify_one();
+}
+
+void CallbackPool::Work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return !jobs.empty(); });
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "Network/Router.h"
+
+namespace Http {
+/*CallbackPool is the built-in CallbackExecutor: a fixed number of detached threads
+  taking jobs from one FIFO. Used when RouterOptions::callbackThreads is set*/
+class CallbackPool : public CallbackExecutor {
+public:
+    explicit CallbackPool(size_t threads);
+    CallbackPool(const CallbackPool&) = delete;
+    CallbackPool& operator=(const CallbackPool&) = delete;
+    virtual void Post(std::function<void()>&& job) override;
+private:
+    void Work();
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()> > jobs;
+};
+
+}
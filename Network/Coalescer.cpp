@@ -0,0 +1,153 @@
+﻿#include "stdafx.h"
+#include <memory>
+#include "Coalescer.h"
+
+namespace Http {
+
+Coalescer::Group::Group(Coalescer& owner, const Task& task)
+    : owner(owner), url(task.Url()), key(Key(task.Url())), mark(task.Mark()), live(1), listed(true) {
+    Subscriber first = { task.Action(), task.UserData(), task.Mark(), false };
+    subscribers.push_back(first);
+}
+
+void Coalescer::Group::Do(const Task& task) {
+    std::vector<Subscriber> fanOut;
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        owner.Unlist(*this);
+        for (auto const& subscriber : subscribers) {
+            owner.subscribed.erase(subscriber.mark);
+            //a cancelled one was completed by Cancel
+            if (!subscriber.cancelled) {
+                fanOut.push_back(subscriber);
+            }
+        }
+        subscribers.clear();
+    }
+    //each subscriber sees its own Action, UserData and mark. All but the last get a copy,
+    //as Do may take the body; the last one gets the task, which is freed right after
+    Task& shared = const_cast<Task&>(task);
+    for (size_t i = 0; i < fanOut.size(); ++i) {
+        const Subscriber& subscriber = fanOut[i];
+        std::unique_ptr<Task> copy(i + 1 < fanOut.size() ? new Task(shared) : nullptr);
+        Task& response = copy ? *copy : shared;
+        response.Action(subscriber.action);
+        response.UserData(subscriber.userData);
+        response.Mark(subscriber.mark);
+        subscriber.action->Do(response);
+    }
+    delete this;
+}
+
+int Coalescer::Group::Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) {
+    std::vector<Subscriber> listening;
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        for (auto const& subscriber : subscribers) {
+            if (!subscriber.cancelled) {
+                listening.push_back(subscriber);
+            }
+        }
+    }
+    //called on the excutor thread owning the task, nothing else touches it meanwhile
+    Task& shared = const_cast<Task&>(task);
+    Base* userData = shared.UserData();
+    int result = 0;
+    for (auto const& subscriber : listening) {
+        if (totaltime - subscriber.action->LastTime() < subscriber.action->ProgressInterval()) {
+            continue;
+        }
+        subscriber.action->LastTime((float)totaltime);
+        shared.UserData(subscriber.userData);
+        shared.Mark(subscriber.mark);
+        if (subscriber.action->Progress(totaltime, dltotal, dlnow, ultotal, ulnow, shared) != 0) {
+            //completes the subscriber now, aborts the shared transfer only once no one else wants it
+            owner.router.Cancel(subscriber.mark);
+            std::lock_guard<std::mutex> lock(owner.mutex);
+            result = live == 0 ? 1 : result;
+        }
+    }
+    shared.UserData(userData);
+    shared.Mark(mark);
+    return result;
+}
+
+std::string Coalescer::Key(const URL& url) {
+    return url.Host() + " " + url.ToString() + "?" + url.GetAttribMap().ToString();
+}
+
+void Coalescer::Unlist(Group& group) {
+    if (!group.listed) {
+        return;
+    }
+    group.listed = false;
+    auto range = groups.equal_range(group.key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == &group) {
+            groups.erase(it);
+            return;
+        }
+    }
+}
+
+bool Coalescer::Join(Task& task, bool lead) {
+    std::string key = Key(task.Url());
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = groups.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        Group* group = it->second;
+        if (group->url == task.Url()) {
+            Subscriber subscriber = { task.Action(), task.UserData(), task.Mark(), false };
+            group->subscribers.push_back(subscriber);
+            ++group->live;
+            subscribed[task.Mark()] = group;
+            //Request owns its UserData, it goes to the task of the fan out
+            task.UserData(nullptr);
+            ++saved;
+            return true;
+        }
+    }
+    if (lead) {
+        Group* group = new Group(*this, task);
+        groups.insert(std::make_pair(key, group));
+        subscribed[task.Mark()] = group;
+        task.Action(group);
+        //the first subscriber's UserData goes with its own response, like every other's
+        task.UserData(nullptr);
+    }
+    return false;
+}
+
+bool Coalescer::Cancel(long long mark, long long& forward, Task*& cancelled) {
+    forward = -1;
+    cancelled = nullptr;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = subscribed.find(mark);
+    if (it == subscribed.end()) {
+        return false;
+    }
+    Group* group = it->second;
+    for (auto& subscriber : group->subscribers) {
+        if (subscriber.mark == mark && !subscriber.cancelled) {
+            subscriber.cancelled = true;
+            //it stays listed until the fan out, a second Cancel must not reach the shared task
+            cancelled = new Task(group->url, subscriber.action, subscriber.userData);
+            cancelled->Mark(subscriber.mark);
+            cancelled->Status(Response::CANCELLED);
+            cancelled->CurlCode(CURLE_ABORTED_BY_CALLBACK);
+            subscriber.userData = nullptr;
+            if (--group->live == 0) {
+                //a request arriving now starts afresh rather than joining a dying transfer
+                Unlist(*group);
+                forward = group->mark;
+            }
+        }
+    }
+    return true;
+}
+
+void Coalescer::Stats(RouterStats& stats) const {
+    stats.coalesced = saved;
+}
+
+}
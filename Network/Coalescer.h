@@ -0,0 +1,67 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Network/Router.h"
+
+namespace Http {
+/*Coalescer merges identical GETs, see RouterOptions::coalesceGets. While one is
+  pending or in flight, a later one equal by URL::operator== subscribes to it
+  instead of becoming a task, and the single Response is fanned out to every
+  subscriber. The options of the first request apply to all of them.*/
+class Coalescer {
+public:
+    Coalescer(Router& router) : router(router), saved(0) {}
+    Coalescer(const Coalescer&) = delete;
+    Coalescer& operator=(const Coalescer&) = delete;
+    //any thread: true if task subscribed to an identical one with its Action and UserData,
+    //the caller then frees it and returns its mark. Otherwise with lead the task becomes the transfer of a new group
+    bool Join(Task& task, bool lead);
+    //any thread: false if mark is no subscriber. A subscriber is cancelled on its own,
+    //cancelled is its task to complete now as Response::CANCELLED, nullptr if it already was.
+    //forward is the mark of the shared task to cancel once no subscriber is left, else -1
+    bool Cancel(long long mark, long long& forward, Task*& cancelled);
+    //readable from any thread
+    void Stats(RouterStats& stats) const;
+private:
+    struct Subscriber {
+        Action* action;
+        Base* userData;
+        long long mark;
+        bool cancelled;
+    };
+    /*the Action of a shared task, it frees itself after the fan out. The task carries no
+      UserData, each subscriber's goes with its own response*/
+    class Group : public Action {
+    public:
+        Group(Coalescer& owner, const Task& task);
+        virtual void Do(const Task& task) override;
+        virtual int Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) override;
+        //every tick reaches Progress, each subscriber is throttled by its own Action
+        virtual double ProgressInterval() const override { return 0; }
+    private:
+        friend class Coalescer;
+        Coalescer& owner;
+        URL url;
+        std::string key;
+        long long mark;
+        //guarded by the owner's mutex
+        std::vector<Subscriber> subscribers;
+        size_t live;
+        bool listed;
+    };
+    //bucket of url, groups in it are told apart by URL::operator==
+    static std::string Key(const URL& url);
+    //unlist group, no one can join it any more
+    void Unlist(Group& group);
+private:
+    Router& router;
+    mutable std::mutex mutex;
+    std::unordered_multimap<std::string, Group*> groups;
+    std::unordered_map<long long, Group*> subscribed;
+    std::atomic<unsigned long long> saved;
+};
+
+}
@@ -0,0 +1,375 @@
+﻿#include "stdafx.h"
+#include <cstring>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "DiskCache.h"
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <dirent.h>
+#endif
+
+namespace Http {
+
+enum : unsigned int {
+    INDEX_MAGIC = 0x58444e49,
+    RECORD_MAGIC = 0x44434552,
+    VERSION = 1
+};
+
+//views start at multiples of this, the allocation granularity of Windows
+static const unsigned long long GRANULARITY = 65536;
+//recent views kept mapped, lent ones live on with their responses
+static const size_t CACHED_VIEWS = 8;
+static const size_t CACHED_VIEW_BYTES = 64 << 20;
+
+struct IndexHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long generation;
+};
+
+/*segment record: this header, then key, headers, etag, lastModified and body*/
+struct RecordHeader {
+    unsigned int magic;
+    unsigned int keySize;
+    unsigned int headersSize;
+    unsigned int etagSize;
+    unsigned int lastModifiedSize;
+    unsigned int reserved;
+    unsigned long long bodySize;
+};
+
+struct DiskCache::SegmentFile {
+    ~SegmentFile() {
+        if (!removeOnRelease.empty()) {
+            remove(removeOnRelease.c_str());
+        }
+    }
+    //set when the next generation starts
+    std::string removeOnRelease;
+};
+
+struct DiskCache::Mapping {
+    Mapping() : base(nullptr), length(0), offset(0), record(nullptr) {}
+    ~Mapping() {
+        if (base) {
+            #ifdef _WIN32
+            UnmapViewOfFile(base);
+            #else
+            munmap(base, length);
+            #endif
+        }
+    }
+    //the view, from offset rounded down to GRANULARITY
+    char* base;
+    size_t length;
+    //the record it was mapped for
+    unsigned long long offset;
+    const char* record;
+    std::shared_ptr<SegmentFile> file;
+};
+
+/*length bytes of the file at path from offset, a multiple of GRANULARITY, mapped read-only.
+  nullptr on failure*/
+static char* Map(const std::string& path, unsigned long long offset, size_t length) {
+    #ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    unsigned long long size = offset + length;
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, (DWORD)(size >> 32), (DWORD)size, NULL);
+    char* base = mapping ? (char*)MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, length) : nullptr;
+    //the view keeps the file mapped after the handles are closed
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return base;
+    #else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, (off_t)offset);
+    close(fd);
+    return base == MAP_FAILED ? nullptr : (char*)base;
+    #endif
+}
+
+static unsigned long long FileSize(const std::string& path) {
+    #ifdef _WIN32
+    struct _stat64 status;
+    return _stat64(path.c_str(), &status) == 0 ? (unsigned long long)status.st_size : 0;
+    #else
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 ? (unsigned long long)status.st_size : 0;
+    #endif
+}
+
+static void MakeDirectory(const std::string& path) {
+    #ifdef _WIN32
+    CreateDirectoryA(path.c_str(), NULL);
+    #else
+    mkdir(path.c_str(), 0755);
+    #endif
+}
+
+/*remove the segment files in directory but the one named keep*/
+static void RemoveSegments(const std::string& directory, const std::string& keep) {
+    #ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((directory + "/segment.*").c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        if (keep != found.cFileName) {
+            remove((directory + "/" + found.cFileName).c_str());
+        }
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+    #else
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "segment.", 8) == 0 && keep != entry->d_name) {
+            remove((directory + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    #endif
+}
+
+DiskCache::~DiskCache() {
+    Close();
+}
+
+unsigned long long DiskCache::Hash(const std::string& key) {
+    //FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string DiskCache::SegmentPath(unsigned long long generation) const {
+    return directory + "/segment." + std::to_string(generation);
+}
+
+std::string DiskCache::IndexPath() const {
+    return directory + "/index";
+}
+
+bool DiskCache::Open(const std::string& directory, size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Close();
+    if (directory.empty()) {
+        return false;
+    }
+    this->directory = directory;
+    this->capacity = capacity;
+    MakeDirectory(directory);
+    FILE* in = fopen(IndexPath().c_str(), "rb");
+    IndexHeader header;
+    bool valid = in && fread(&header, sizeof(header), 1, in) == 1 && header.magic == INDEX_MAGIC && header.version == VERSION;
+    if (valid) {
+        generation = header.generation;
+        IndexRecord record;
+        while (fread(&record, sizeof(record), 1, in) == 1) {
+            records[record.hash] = record;
+        }
+    }
+    if (in) {
+        fclose(in);
+    }
+    segment = fopen(SegmentPath(generation).c_str(), valid ? "ab" : "wb");
+    file = std::make_shared<SegmentFile>();
+    if (segment == nullptr) {
+        Close();
+        return false;
+    }
+    size = valid ? FileSize(SegmentPath(generation)) : 0;
+    //records past the end were torn by a crash
+    for (auto it = records.begin(); it != records.end();) {
+        if (it->second.offset + it->second.length > size) {
+            it = records.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    //older generations whose views outlived the process, or every segment of a lost index
+    RemoveSegments(directory, "segment." + std::to_string(generation));
+    if (!WriteIndex()) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool DiskCache::Opened() const {
+    return segment != nullptr;
+}
+
+void DiskCache::Close() {
+    if (segment) {
+        fclose(segment);
+        segment = nullptr;
+    }
+    if (index) {
+        fclose(index);
+        index = nullptr;
+    }
+    records.clear();
+    views.clear();
+    viewBytes = 0;
+    file.reset();
+    generation = 0;
+    size = 0;
+}
+
+bool DiskCache::WriteIndex() {
+    if (index) {
+        fclose(index);
+    }
+    index = fopen(IndexPath().c_str(), "wb");
+    if (index == nullptr) {
+        return false;
+    }
+    IndexHeader header = { INDEX_MAGIC, VERSION, generation };
+    bool written = fwrite(&header, sizeof(header), 1, index) == 1;
+    for (auto const& record : records) {
+        written = written && fwrite(&record.second, sizeof(record.second), 1, index) == 1;
+    }
+    return fflush(index) == 0 && written;
+}
+
+bool DiskCache::Append(const IndexRecord& record) {
+    return index && fwrite(&record, sizeof(record), 1, index) == 1 && fflush(index) == 0;
+}
+
+bool DiskCache::Roll() {
+    fclose(segment);
+    segment = nullptr;
+    //gone now unless a lent view still maps it
+    file->removeOnRelease = SegmentPath(generation);
+    file = std::make_shared<SegmentFile>();
+    views.clear();
+    viewBytes = 0;
+    ++generation;
+    size = 0;
+    records.clear();
+    segment = fopen(SegmentPath(generation).c_str(), "wb");
+    return segment != nullptr && WriteIndex();
+}
+
+std::shared_ptr<DiskCache::Mapping> DiskCache::MapRecord(const IndexRecord& record) {
+    for (size_t i = 0; i < views.size(); ++i) {
+        if (views[i]->offset == record.offset) {
+            std::rotate(views.begin(), views.begin() + i, views.begin() + i + 1);
+            return views.front();
+        }
+    }
+    std::shared_ptr<Mapping> fresh(new Mapping());
+    unsigned long long begin = record.offset / GRANULARITY * GRANULARITY;
+    fresh->length = (size_t)(record.offset + record.length - begin);
+    fresh->base = Map(SegmentPath(generation), begin, fresh->length);
+    if (fresh->base == nullptr) {
+        return nullptr;
+    }
+    fresh->offset = record.offset;
+    fresh->record = fresh->base + (record.offset - begin);
+    fresh->file = file;
+    views.insert(views.begin(), fresh);
+    viewBytes += fresh->length;
+    //the newest view stays even if it alone is over the bytes
+    while (views.size() > 1 && (views.size() > CACHED_VIEWS || viewBytes > CACHED_VIEW_BYTES)) {
+        viewBytes -= views.back()->length;
+        views.pop_back();
+    }
+    return fresh;
+}
+
+bool DiskCache::Find(const std::string& key, View& view) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = records.find(Hash(key));
+    if (segment == nullptr || it == records.end()) {
+        return false;
+    }
+    const IndexRecord& record = it->second;
+    std::shared_ptr<Mapping> mapping = record.length < sizeof(RecordHeader) ? nullptr : MapRecord(record);
+    if (!mapping) {
+        return false;
+    }
+    const char* at = mapping->record;
+    RecordHeader header;
+    memcpy(&header, at, sizeof(header));
+    unsigned long long length = sizeof(header) + (unsigned long long)header.keySize + header.headersSize + header.etagSize
+                                + header.lastModifiedSize + header.bodySize;
+    //a hash collision or a damaged record
+    if (header.magic != RECORD_MAGIC || length != record.length || header.keySize != key.size()
+            || memcmp(at + sizeof(header), key.data(), key.size()) != 0) {
+        return false;
+    }
+    at += sizeof(header) + header.keySize;
+    view.headers.assign(at, header.headersSize);
+    at += header.headersSize;
+    view.etag.assign(at, header.etagSize);
+    at += header.etagSize;
+    view.lastModified.assign(at, header.lastModifiedSize);
+    at += header.lastModifiedSize;
+    view.addr = const_cast<char*>(at);
+    view.size = (size_t)header.bodySize;
+    view.owner = mapping;
+    view.fresh = record.expires > (long long)time(nullptr);
+    return true;
+}
+
+void DiskCache::Store(const std::string& key, const char* body, size_t bodySize, const std::string& headers,
+                      const std::string& etag, const std::string& lastModified, long long seconds) {
+    RecordHeader header = { RECORD_MAGIC, (unsigned int)key.size(), (unsigned int)headers.size(), (unsigned int)etag.size(),
+                            (unsigned int)lastModified.size(), 0, bodySize
+                          };
+    unsigned long long length = sizeof(header) + (unsigned long long)key.size() + headers.size() + etag.size() + lastModified.size() + bodySize;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (segment == nullptr || length > capacity) {
+        return;
+    }
+    if (size + length > capacity && !Roll()) {
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, segment) == 1
+                   && fwrite(key.data(), 1, key.size(), segment) == key.size()
+                   && fwrite(headers.data(), 1, headers.size(), segment) == headers.size()
+                   && fwrite(etag.data(), 1, etag.size(), segment) == etag.size()
+                   && fwrite(lastModified.data(), 1, lastModified.size(), segment) == lastModified.size()
+                   && fwrite(body, 1, bodySize, segment) == bodySize;
+    if (fflush(segment) != 0 || !written) {
+        //the segment is torn from here on, start afresh
+        Roll();
+        return;
+    }
+    IndexRecord record = { Hash(key), size, length, (long long)time(nullptr) + std::max(0LL, seconds) };
+    size += length;
+    records[record.hash] = record;
+    Append(record);
+}
+
+void DiskCache::Refresh(const std::string& key, long long seconds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = records.find(Hash(key));
+    if (it == records.end()) {
+        return;
+    }
+    it->second.expires = (long long)time(nullptr) + std::max(0LL, seconds);
+    Append(it->second);
+}
+
+}
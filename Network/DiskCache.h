@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace Http {
+/*DiskCache is the persistent tier behind ResponseCache, see RouterOptions::diskCachePath.
+  Bodies are appended to a segment file and read back through a read-only view of
+  their record, the few most recent views stay mapped. A compact index of fixed size records keyed by a hash of URL::Canonical is all
+  that is read at startup, the bodies are never scanned. A full segment starts the
+  next generation, the old file is removed once no view maps it any more.*/
+class DiskCache {
+public:
+    /*a cached response, addr stays valid while owner lives*/
+    struct View {
+        char* addr;
+        size_t size;
+        std::shared_ptr<void> owner;
+        std::string headers;
+        std::string etag;
+        std::string lastModified;
+        bool fresh;
+    };
+    DiskCache() : capacity(0), generation(0), size(0), segment(nullptr), index(nullptr), viewBytes(0) {}
+    ~DiskCache();
+    DiskCache(const DiskCache&) = delete;
+    DiskCache& operator=(const DiskCache&) = delete;
+    //(re)open the cache kept in directory, segments of at most capacity bytes. Empty closes it
+    bool Open(const std::string& directory, size_t capacity);
+    bool Opened() const;
+    //false if key is not cached
+    bool Find(const std::string& key, View& view);
+    //append a response fresh for seconds, replacing an older one of key
+    void Store(const std::string& key, const char* body, size_t bodySize, const std::string& headers,
+               const std::string& etag, const std::string& lastModified, long long seconds);
+    //a 304 made the response of key fresh for seconds again
+    void Refresh(const std::string& key, long long seconds);
+private:
+    /*fixed size index entry, the last one of a hash wins*/
+    struct IndexRecord {
+        unsigned long long hash;
+        unsigned long long offset;
+        unsigned long long length;
+        long long expires;
+    };
+    /*the file of a generation, an older one is removed once no view maps it any more*/
+    struct SegmentFile;
+    /*a read-only view of one record of a segment*/
+    struct Mapping;
+    static unsigned long long Hash(const std::string& key);
+    std::string SegmentPath(unsigned long long generation) const;
+    std::string IndexPath() const;
+    void Close();
+    //rewrite the index with the live records only
+    bool WriteIndex();
+    bool Append(const IndexRecord& record);
+    //start the next generation, the current segment is dropped
+    bool Roll();
+    //a view of record, a cached one if any, nullptr on failure
+    std::shared_ptr<Mapping> MapRecord(const IndexRecord& record);
+private:
+    std::mutex mutex;
+    std::string directory;
+    size_t capacity;
+    unsigned long long generation;
+    //bytes appended to the segment
+    unsigned long long size;
+    FILE* segment;
+    FILE* index;
+    std::unordered_map<unsigned long long, IndexRecord> records;
+    std::shared_ptr<SegmentFile> file;
+    //most recently used first, bounded in count and bytes
+    std::vector<std::shared_ptr<Mapping> > views;
+    size_t viewBytes;
+};
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include "Network/curl/curl.h"
+
+namespace Http {
+/*EasyHandlePool keeps finished easy handles of one excutor for reuse,
+  curl_easy_reset clears options but keeps caches, buffers and session tickets*/
+class EasyHandlePool {
+public:
+    explicit EasyHandlePool(size_t capacity) : capacity(capacity), created(0), reused(0) {
+        idle.reserve(capacity);
+    }
+    ~EasyHandlePool() {
+        for (CURL* eh : idle) {
+            curl_easy_cleanup(eh);
+        }
+    }
+    EasyHandlePool(const EasyHandlePool&) = delete;
+    EasyHandlePool& operator=(const EasyHandlePool&) = delete;
+
+    CURL* Acquire() {
+        if (idle.empty()) {
+            ++created;
+            return curl_easy_init();
+        }
+        ++reused;
+        CURL* eh = idle.back();
+        idle.pop_back();
+        return eh;
+    }
+    //form and header list live as long as the transfer, they are freed on Release
+    void Own(CURL* eh, struct curl_httppost* formpost, struct curl_slist* headerlist) {
+        Resources& resources = owned[eh];
+        resources.formpost = formpost;
+        resources.headerlist = headerlist;
+    }
+    void Release(CURL* eh) {
+        auto it = owned.find(eh);
+        if (it != owned.end()) {
+            curl_formfree(it->second.formpost);
+            curl_slist_free_all(it->second.headerlist);
+            owned.erase(it);
+        }
+        if (idle.size() < capacity) {
+            curl_easy_reset(eh);
+            idle.push_back(eh);
+        } else {
+            curl_easy_cleanup(eh);
+        }
+    }
+    void Capacity(size_t val) {
+        capacity = val;
+        while (idle.size() > capacity) {
+            curl_easy_cleanup(idle.back());
+            idle.pop_back();
+        }
+    }
+    //readable from any thread
+    size_t Created() const {
+        return created;
+    }
+    size_t Reused() const {
+        return reused;
+    }
+private:
+    struct Resources {
+        struct curl_httppost* formpost;
+        struct curl_slist* headerlist;
+    };
+    size_t capacity;
+    std::vector<CURL*> idle;
+    std::unordered_map<CURL*, Resources> owned;
+    std::atomic<size_t> created;
+    std::atomic<size_t> reused;
+};
+
+}
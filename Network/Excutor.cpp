@@ -0,0 +1,847 @@
+﻿#include "stdafx.h"
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "Excutor.h"
+
+namespace Http {
+
+/*share of a Router wide limit for one of shards excutors, 0 stays unlimited*/
+static size_t Share(size_t limit, size_t shards) {
+    if (limit == 0) {
+        return 0;
+    }
+    shards = std::max<size_t>(1, shards);
+    return (limit + shards - 1) / shards;
+}
+
+/*share of a Router wide token budget, the ratio stays as every excutor earns its own*/
+static RetryBudget Share(const RetryBudget& budget, size_t shards) {
+    shards = std::max<size_t>(1, shards);
+    return RetryBudget(budget.ratio, budget.minPerSecond / shards, budget.burst / shards);
+}
+
+/*a per request deadline, -1 falls back to the Router wide one*/
+static long long Resolve(long long requested, long long fallback) {
+    return requested < 0 ? fallback : requested;
+}
+
+/*full jitter: a random wait below the exponential bound, so retries of a burst spread out*/
+static long long Backoff(const RetryPolicy& policy, int retry, std::mt19937& jitter) {
+    long long bound = std::max<long long>(1, policy.baseDelayMs);
+    for (int i = 1; i < retry && bound < policy.maxDelayMs; ++i) {
+        bound *= 2;
+    }
+    bound = std::max<long long>(1, std::min(bound, policy.maxDelayMs));
+    return std::uniform_int_distribution<long long>(0, bound)(jitter);
+}
+
+/*latency samples a host needs before hedge delays follow its percentile*/
+static const size_t HEDGE_SAMPLES = 32;
+
+static size_t WriteMemoryCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t realsize = size * nmemb;
+    Task* task = (Task*)userp;
+    if (task->Options().stream) {
+        switch (task->Action()->OnData((const char*)contents, realsize, *task)) {
+        case Action::CONTINUE:
+            return realsize;
+        case Action::PAUSE:
+            return CURL_WRITEFUNC_PAUSE;
+        default:
+            return 0;
+        }
+    }
+    // dltotal == 0则未获取总大小，>0则已获得为realloc，<0 则已realloc
+    if (task->Dltotal() > 0) {
+        task->MemoryAddr((char*)realloc(task->MemoryAddr(), task->Dltotal() + 1));
+        task->Dltotal(-1);
+    } else if (task->Dltotal() == 0) {
+        task->MemoryAddr((char*)realloc(task->MemoryAddr(), task->Size() + realsize + 1));
+    }
+    memcpy(&(task->MemoryAddr()[task->Size()]), contents, realsize);
+    task->Size(task->Size() + realsize);
+    //task->MemoryAddr()[task->Size()] = 0;
+    return realsize;
+}
+
+static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp) {
+    Task* task = (Task*)userp;
+    task->ResponseHeaders().append(buffer, size * nitems);
+    return size * nitems;
+}
+
+static int xferinfo(void* p, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    double curtime = 0;
+    Task* task = (Task*)p;
+    curl_easy_getinfo(task->Curl(), CURLINFO_TOTAL_TIME, &curtime);
+    if (task->Dltotal() == 0 && dltotal != 0) {
+        task->Dltotal(dltotal);
+    }
+    if (curtime - task->Action()->LastTime() >= task->Action()->ProgressInterval()) {
+        task->Action()->LastTime(curtime);
+        return task->Action()->Progress(curtime, (double)dltotal, (double)dlnow, ultotal, ulnow, *task);
+
+    }
+    return 0;
+}
+
+static int older_progress(void* p, double dltotal, double dlnow, double ultotal, double ulnow) {
+    return xferinfo(p, (curl_off_t)dltotal, (curl_off_t)dlnow, (curl_off_t)ultotal, (curl_off_t)ulnow);
+}
+
+
+void Excutor::Init(Task& unhandledTask) {
+    CURL* eh = easyHandles.Acquire();
+    share.Attach(eh);
+    unhandledTask.Curl(eh);
+    //check request type
+    if (unhandledTask.Type() == Request::TYPE::POST) {
+        struct curl_httppost* formpost = NULL;
+        struct curl_httppost* lastptr = NULL;
+
+        struct curl_slist* headerlist = NULL;
+        static const char buf[] = "Expect:";
+
+        const std::vector<UploadedData>& uploadedDatas = unhandledTask.Uploadeddatas();
+        for (auto data : uploadedDatas) {
+            CURLformoption opt;
+            if (data.Field() == UploadedData::FIELD::FILE) {
+                opt = CURLformoption::CURLFORM_FILE;
+            } else {
+                opt = CURLformoption::CURLFORM_COPYCONTENTS;
+            }
+            if (data.FileName().empty()) {
+                curl_formadd(&formpost, &lastptr,
+                             CURLFORM_COPYNAME, data.Key().c_str(),
+                             opt, data.Value().c_str(),
+                             CURLFORM_END);
+            } else {
+                curl_formadd(&formpost, &lastptr,
+                             CURLFORM_COPYNAME, data.Key().c_str(),
+                             opt, data.Value().c_str(), CURLFORM_FILENAME, data.FileName().c_str(),
+                             CURLFORM_END);
+            }
+        }
+        headerlist = curl_slist_append(headerlist, buf);
+        for (auto const& header : unhandledTask.Headers()) {
+            headerlist = curl_slist_append(headerlist, header.c_str());
+        }
+        curl_easy_setopt(eh, CURLOPT_HTTPHEADER, headerlist);
+        curl_easy_setopt(eh, CURLOPT_HTTPPOST, formpost);
+        easyHandles.Own(eh, formpost, headerlist);
+    } else if (!unhandledTask.Headers().empty()) {
+        struct curl_slist* headerlist = NULL;
+        for (auto const& header : unhandledTask.Headers()) {
+            headerlist = curl_slist_append(headerlist, header.c_str());
+        }
+        curl_easy_setopt(eh, CURLOPT_HTTPHEADER, headerlist);
+        easyHandles.Own(eh, NULL, headerlist);
+    }
+    if (unhandledTask.Options().keepHeaders) {
+        curl_easy_setopt(eh, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(eh, CURLOPT_HEADERDATA, (void*)&unhandledTask);
+    }
+    //set easy handle option
+    curl_easy_setopt(eh, CURLOPT_PRIVATE, (void*)&unhandledTask);
+    curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+    curl_easy_setopt(eh, CURLOPT_WRITEDATA, (void*)&unhandledTask);
+    curl_easy_setopt(eh, CURLOPT_VERBOSE, 0L);
+    curl_easy_setopt(eh, CURLOPT_NOPROGRESS, 0);
+    #if LIBCURL_VERSION_NUM >= 0x072000
+    curl_easy_setopt(eh, CURLOPT_XFERINFOFUNCTION, xferinfo);
+    curl_easy_setopt(eh, CURLOPT_XFERINFODATA, &unhandledTask);
+    #else
+    curl_easy_setopt(eh, CURLOPT_PROGRESSFUNCTION, older_progress);
+    curl_easy_setopt(eh, CURLOPT_PROGRESSDATA, &unhandledTask);
+    #endif
+
+    curl_easy_setopt(eh, CURLOPT_HEADER, 0L);
+    long long connectMs = Resolve(unhandledTask.Options().connectTimeoutMs, connectTimeoutMs);
+    if (connectMs > 0) {
+        curl_easy_setopt(eh, CURLOPT_CONNECTTIMEOUT_MS, (long)connectMs);
+    }
+    unhandledTask.Url().Escape(eh);
+    curl_easy_setopt(eh, CURLOPT_URL, unhandledTask.Url().ToString().c_str());
+    if (multiplex) {
+        const std::string& url = unhandledTask.Url().ToString();
+        bool plain = url.compare(0, 7, "http://") == 0 || url.find("://") == std::string::npos;
+        curl_easy_setopt(eh, CURLOPT_HTTP_VERSION, plain && http2PriorKnowledge ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2TLS);
+        //wait for a connection to multiplex on instead of opening a new one
+        curl_easy_setopt(eh, CURLOPT_PIPEWAIT, 1L);
+    }
+    curl_multi_add_handle(cm, eh);
+}
+
+/*libcurl tells which sockets to watch, the poller keeps them*/
+static int SocketCallback(CURL*, curl_socket_t s, int what, void* userp, void*) {
+    Poller* poller = (Poller*)userp;
+    if (what == CURL_POLL_REMOVE) {
+        poller->Unwatch(s);
+    } else {
+        int events = Poller::NONE;
+        if (what & CURL_POLL_IN) events |= Poller::IN;
+        if (what & CURL_POLL_OUT) events |= Poller::OUT;
+        poller->Watch(s, events);
+    }
+    return 0;
+}
+
+/*libcurl tells when it wants to be called with CURL_SOCKET_TIMEOUT, -1 means no timer*/
+static int TimerCallback(CURLM*, long timeoutMs, void* userp) {
+    Clock::time_point* deadline = (Clock::time_point*)userp;
+    *deadline = timeoutMs < 0 ? Clock::time_point::max() : Clock::now() + std::chrono::milliseconds(timeoutMs);
+    return 0;
+}
+
+Excutor::Excutor(std::vector<Excutor*>& peers, const ShareCache& share, Admission& admission, CallbackExecutor* callbacks,
+                 const RouterOptions& options)
+    : peers(peers), share(share), admission(admission), callbacks(callbacks), submissions(options.submissionCapacity), cm(curl_multi_init()),
+      easyHandles(options.easyHandlePoolSize), backlog(0), idle(false), active(0),
+      maxConcurrency(0), multiplex(false), http2PriorKnowledge(false), connectTimeoutMs(0), timeoutMs(0), idleTimeoutMs(0),
+      retryTokens(-1), retryRefilledAt(Clock::now()), jitter((unsigned)(Clock::now().time_since_epoch().count() ^ (uintptr_t)this)),
+      retries(0), retriesDenied(0), hedgeTokens(-1), hedgesSent(0), hedgesWon(0), pendingOptions(options), optionsChanged(true) {
+    curl_multi_setopt(cm, CURLMOPT_SOCKETFUNCTION, SocketCallback);
+    curl_multi_setopt(cm, CURLMOPT_SOCKETDATA, &poller);
+    curl_multi_setopt(cm, CURLMOPT_TIMERFUNCTION, TimerCallback);
+    poller.Watch(waker.Socket(), Poller::IN);
+}
+
+Excutor::~Excutor() {
+    curl_multi_cleanup(cm);
+}
+
+void Excutor::Start() {
+    std::thread excutor(&Excutor::Loop, this);
+    excutor.detach();
+}
+
+bool Excutor::Submit(Task* task) {
+    return submissions.TryPush(task);
+}
+
+bool Excutor::Submit(Task* const* tasks, size_t count) {
+    return submissions.TryPush(tasks, count);
+}
+
+size_t Excutor::SubmissionCapacity() const {
+    return submissions.Capacity();
+}
+
+void Excutor::Wake() {
+    waker.Wake();
+}
+
+size_t Excutor::Backlog() const {
+    return backlog;
+}
+
+bool Excutor::Idle() const {
+    return idle;
+}
+
+const EasyHandlePool& Excutor::EasyHandles() const {
+    return easyHandles;
+}
+
+const TaskQueue& Excutor::Tasks() const {
+    return taskQueue;
+}
+
+void Excutor::Configure(const RouterOptions& options) {
+    {
+        std::lock_guard<std::mutex> lock(optionsMutex);
+        pendingOptions = options;
+    }
+    optionsChanged = true;
+    Wake();
+}
+
+void Excutor::ApplyOptions() {
+    RouterOptions options;
+    {
+        std::lock_guard<std::mutex> lock(optionsMutex);
+        options = pendingOptions;
+        optionsChanged = false;
+    }
+    size_t shards = peers.size();
+    maxConcurrency = Share(options.maxConcurrency, shards);
+    easyHandles.Capacity(options.easyHandlePoolSize);
+    curl_multi_setopt(cm, CURLMOPT_MAX_HOST_CONNECTIONS, (long)Share(options.maxHostConnections, shards));
+    curl_multi_setopt(cm, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)Share(options.maxTotalConnections, shards));
+    /* we can optionally limit the total amount of connections this multi handle uses */
+    curl_multi_setopt(cm, CURLMOPT_MAXCONNECTS, (long)Share(options.maxConnects, shards));
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        taskQueue.Configure(options, shards);
+    }
+    multiplex = options.multiplex;
+    http2PriorKnowledge = options.http2PriorKnowledge;
+    connectTimeoutMs = options.connectTimeoutMs;
+    timeoutMs = options.timeoutMs;
+    idleTimeoutMs = options.idleTimeoutMs;
+    retry = options.retry;
+    retryBudget = Share(options.retryBudget, shards);
+    hedge = options.hedge;
+    hedgeBudget = Share(options.hedgeBudget, shards);
+    //a fresh excutor starts with full buckets
+    retryTokens = retryTokens < 0 ? retryBudget.burst : std::min(retryTokens, retryBudget.burst);
+    hedgeTokens = hedgeTokens < 0 ? hedgeBudget.burst : std::min(hedgeTokens, hedgeBudget.burst);
+    curl_multi_setopt(cm, CURLMOPT_PIPELINING, multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+    #if LIBCURL_VERSION_NUM >= 0x074300
+    curl_multi_setopt(cm, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)options.maxStreams);
+    #endif
+}
+
+void Excutor::Cancel(long long mark) {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        cancels.push_back(mark);
+    }
+    Wake();
+}
+
+void Excutor::Resume(long long mark) {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        resumes.push_back(mark);
+    }
+    Wake();
+}
+
+void Excutor::ResumePaused(const std::vector<long long>& resumed) {
+    for (long long mark : resumed) {
+        Task* task = taskQueue.InFlight(mark);
+        //one waiting to retry has no transfer
+        if (task && task->Curl()) {
+            curl_easy_pause(task->Curl(), CURLPAUSE_CONT);
+        }
+    }
+}
+
+bool Excutor::Sheddable(int priority, int& victimPriority, Clock::time_point& queuedAt) {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    return taskQueue.Sheddable(priority, victimPriority, queuedAt);
+}
+
+bool Excutor::Shed(int priority) {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        Task* task = taskQueue.Shed(priority);
+        if (task == nullptr) {
+            return false;
+        }
+        admission.Leave(Admission::Footprint(*task));
+        admission.Shed();
+        task->Status(Response::DROPPED);
+        task->CurlCode(CURLE_ABORTED_BY_CALLBACK);
+        dropped.push_back(task);
+        backlog = taskQueue.PendingSize();
+    }
+    Wake();
+    return true;
+}
+
+void Excutor::Stats(RouterStats& stats) const {
+    stats.retries += retries;
+    stats.retriesDenied += retriesDenied;
+    stats.hedges += hedgesSent;
+    stats.hedgesWon += hedgesWon;
+}
+
+bool Excutor::Collect(long long mark, Response::STATUS status, CURLcode code, std::vector<Task*>& pendingAborted, std::vector<Task*>& flyingAborted) {
+    std::vector<Task*>* aborted = &pendingAborted;
+    Task* task = taskQueue.Remove(mark);
+    if (task == nullptr) {
+        task = taskQueue.InFlight(mark);
+        aborted = &flyingAborted;
+    } else {
+        admission.Leave(Admission::Footprint(*task));
+    }
+    if (task == nullptr) {
+        return false;
+    }
+    //an in-flight task stays in taskQueue until finished, collect it once
+    if (task->Status() == Response::DONE) {
+        task->Status(status);
+        task->CurlCode(code);
+        aborted->push_back(task);
+    }
+    return true;
+}
+
+void Excutor::CollectCancelled(std::vector<Task*>& pendingAborted, std::vector<Task*>& flyingAborted) {
+    for (long long mark : cancels) {
+        Collect(mark, Response::CANCELLED, CURLE_ABORTED_BY_CALLBACK, pendingAborted, flyingAborted);
+    }
+    cancels.clear();
+}
+
+void Excutor::CollectExpired(const std::vector<TimerWheel::Timer*>& fired, Clock::time_point now, std::vector<Task*>& pendingAborted, std::vector<Task*>& flyingAborted) {
+    std::vector<long long> stale;
+    for (TimerWheel::Timer* timer : fired) {
+        if (timer->kind == TOTAL) {
+            if (!Collect(timer->mark, Response::TIMEDOUT, CURLE_OPERATION_TIMEDOUT, pendingAborted, flyingAborted)) {
+                //stolen by a peer, which armed its own timer
+                stale.push_back(timer->mark);
+            }
+            continue;
+        }
+        Task* task = taskQueue.InFlight(timer->mark);
+        if (task == nullptr) {
+            continue;
+        }
+        if (timer->kind == RETRY) {
+            //a task collected this turn is on its way out
+            if (task->Status() == Response::DONE) {
+                Redispatch(*task, now);
+            }
+            continue;
+        }
+        if (timer->kind == HEDGE) {
+            if (task->Status() == Response::DONE && task->Curl() && hedges.find(task->Mark()) == hedges.end()) {
+                Hedge(*task);
+            }
+            continue;
+        }
+        Deadline& deadline = deadlines[timer->mark];
+        double down = 0, up = 0;
+        curl_easy_getinfo(task->Curl(), CURLINFO_SIZE_DOWNLOAD, &down);
+        curl_easy_getinfo(task->Curl(), CURLINFO_SIZE_UPLOAD, &up);
+        if (down + up != deadline.transferred) {
+            //moved since armed, look again one idle period from now
+            deadline.transferred = down + up;
+            timers.Arm(deadline.idle, now + std::chrono::milliseconds(deadline.idleMs));
+        } else {
+            Collect(timer->mark, Response::TIMEDOUT, CURLE_OPERATION_TIMEDOUT, pendingAborted, flyingAborted);
+        }
+    }
+    for (long long mark : stale) {
+        Forget(mark);
+    }
+}
+
+void Excutor::ArmTotal(const Task& task, Clock::time_point queuedAt) {
+    long long ms = Resolve(task.Options().timeoutMs, timeoutMs);
+    if (ms <= 0) {
+        return;
+    }
+    Deadline& deadline = deadlines[task.Mark()];
+    deadline.total.mark = task.Mark();
+    deadline.total.kind = TOTAL;
+    timers.Arm(deadline.total, queuedAt + std::chrono::milliseconds(ms));
+}
+
+void Excutor::ArmIdle(const Task& task, Clock::time_point now) {
+    long long ms = Resolve(task.Options().idleTimeoutMs, idleTimeoutMs);
+    if (ms <= 0) {
+        return;
+    }
+    Deadline& deadline = deadlines[task.Mark()];
+    deadline.idle.mark = task.Mark();
+    deadline.idle.kind = IDLE;
+    deadline.idleMs = ms;
+    deadline.transferred = 0;
+    timers.Arm(deadline.idle, now + std::chrono::milliseconds(ms));
+}
+
+void Excutor::Forget(long long mark) {
+    auto it = deadlines.find(mark);
+    if (it != deadlines.end()) {
+        timers.Disarm(it->second.total);
+        timers.Disarm(it->second.idle);
+        timers.Disarm(it->second.retry);
+        timers.Disarm(it->second.hedge);
+        deadlines.erase(it);
+    }
+}
+
+void Excutor::Finish(Task* task) {
+    DropHedge(task->Mark());
+    //no handle while waiting to retry
+    CURL* e = task->Curl();
+    if (e) {
+        long responseCode = 0;
+        curl_easy_getinfo(e, CURLINFO_RESPONSE_CODE, &responseCode);
+        task->ResponseCode(responseCode);
+        curl_multi_remove_handle(cm, e);
+    }
+    --active;
+    Forget(task->Mark());
+    taskQueue.Pop(task->Mark());
+    if (callbacks) {
+        //the handle is reused before Do runs
+        task->Curl(nullptr);
+    }
+    Deliver(task);
+    if (e) {
+        easyHandles.Release(e);
+    }
+}
+
+bool Excutor::Retryable(Task& task, CURLcode code, Clock::time_point now) {
+    const RetryPolicy& policy = task.Options().retry.maxAttempts < 0 ? retry : task.Options().retry;
+    if (policy.maxAttempts <= 1 || task.Status() != Response::DONE || (task.Type() == Request::TYPE::POST && !policy.retryPost)) {
+        return false;
+    }
+    if (task.Options().stream) {
+        //OnData cannot take back what it was handed
+        double received = 0;
+        curl_easy_getinfo(task.Curl(), CURLINFO_SIZE_DOWNLOAD, &received);
+        if (received > 0) {
+            return false;
+        }
+    }
+    auto it = deadlines.find(task.Mark());
+    int attempts = 1 + (it == deadlines.end() ? 0 : it->second.retries);
+    if (attempts >= policy.maxAttempts) {
+        return false;
+    }
+    if (code == CURLE_OK) {
+        long responseCode = 0;
+        curl_easy_getinfo(task.Curl(), CURLINFO_RESPONSE_CODE, &responseCode);
+        if (responseCode < 0 || responseCode >= (long)policy.httpStatuses.size() || !policy.httpStatuses.test(responseCode)) {
+            return false;
+        }
+    } else if (code < 0 || code >= (int)policy.curlCodes.size() || !policy.curlCodes.test(code)) {
+        return false;
+    }
+    double elapsed = std::chrono::duration<double>(now - retryRefilledAt).count();
+    retryTokens = std::min(retryBudget.burst, retryTokens + elapsed * retryBudget.minPerSecond);
+    retryRefilledAt = now;
+    if (retryTokens < 1) {
+        ++retriesDenied;
+        return false;
+    }
+    retryTokens -= 1;
+    return true;
+}
+
+void Excutor::Retry(Task& task, Clock::time_point now) {
+    CURL* e = task.Curl();
+    //what the failed attempt got, should the task end before its next one
+    long responseCode = 0;
+    curl_easy_getinfo(e, CURLINFO_RESPONSE_CODE, &responseCode);
+    task.ResponseCode(responseCode);
+    curl_multi_remove_handle(cm, e);
+    task.Curl(nullptr);
+    easyHandles.Release(e);
+    const RetryPolicy& policy = task.Options().retry.maxAttempts < 0 ? retry : task.Options().retry;
+    Deadline& deadline = deadlines[task.Mark()];
+    ++deadline.retries;
+    timers.Disarm(deadline.idle);
+    timers.Disarm(deadline.hedge);
+    deadline.retry.mark = task.Mark();
+    deadline.retry.kind = RETRY;
+    timers.Arm(deadline.retry, now + std::chrono::milliseconds(Backoff(policy, deadline.retries, jitter)));
+    ++retries;
+}
+
+void Excutor::Redispatch(Task& task, Clock::time_point now) {
+    //the body of the failed attempt is overwritten, its buffer is kept
+    task.Size(0);
+    task.Dltotal(0);
+    task.CurlCode(CURLE_OK);
+    task.ResponseCode(0);
+    task.ResponseHeaders().clear();
+    Init(task);
+    ArmIdle(task, now);
+    ArmHedge(task, now);
+}
+
+void Excutor::ArmHedge(const Task& task, Clock::time_point now) {
+    const HedgePolicy& policy = task.Options().hedge.percentile < 0 ? hedge : task.Options().hedge;
+    if (policy.percentile <= 0 || task.Type() != Request::TYPE::GET || task.Options().stream) {
+        return;
+    }
+    long long ms = policy.delayMs;
+    auto it = latencies.find(task.Url().Host());
+    if (it != latencies.end() && it->second.Count() >= HEDGE_SAMPLES) {
+        ms = std::min(std::max(it->second.Percentile(policy.percentile), policy.minDelayMs), policy.maxDelayMs);
+    }
+    Deadline& deadline = deadlines[task.Mark()];
+    deadline.dispatchedAt = now;
+    deadline.hedge.mark = task.Mark();
+    deadline.hedge.kind = HEDGE;
+    timers.Arm(deadline.hedge, now + std::chrono::milliseconds(ms));
+}
+
+void Excutor::Hedge(Task& task) {
+    if (hedgeTokens < 1) {
+        return;
+    }
+    hedgeTokens -= 1;
+    //Request owns its UserData, the twin goes without
+    Task* twin = new Task(task.Url(), task.Action());
+    twin->Options(task.Options());
+    twin->Headers() = task.Headers();
+    twin->Mark(task.Mark());
+    Init(*twin);
+    //progress is reported for the transfer Do gets, see Adopt
+    curl_easy_setopt(twin->Curl(), CURLOPT_NOPROGRESS, 1L);
+    hedges[task.Mark()] = twin;
+    ++hedgesSent;
+}
+
+void Excutor::Adopt(Task& task) {
+    auto it = hedges.find(task.Mark());
+    Task* twin = it->second;
+    hedges.erase(it);
+    CURL* lost = task.Curl();
+    curl_multi_remove_handle(cm, lost);
+    easyHandles.Release(lost);
+    free(task.MemoryAddr());
+    task.MemoryAddr(twin->MemoryAddr());
+    task.Size(twin->Size());
+    task.Dltotal(twin->Dltotal());
+    task.ResponseHeaders().swap(twin->ResponseHeaders());
+    twin->MemoryAddr(nullptr);
+    twin->Size(0);
+    //the transfer may still be running, its callbacks now fill task
+    CURL* e = twin->Curl();
+    task.Curl(e);
+    curl_easy_setopt(e, CURLOPT_PRIVATE, (void*)&task);
+    curl_easy_setopt(e, CURLOPT_WRITEDATA, (void*)&task);
+    if (task.Options().keepHeaders) {
+        curl_easy_setopt(e, CURLOPT_HEADERDATA, (void*)&task);
+    }
+    #if LIBCURL_VERSION_NUM >= 0x072000
+    curl_easy_setopt(e, CURLOPT_XFERINFODATA, &task);
+    #else
+    curl_easy_setopt(e, CURLOPT_PROGRESSDATA, &task);
+    #endif
+    curl_easy_setopt(e, CURLOPT_NOPROGRESS, 0L);
+    delete twin;
+}
+
+void Excutor::DropHedge(long long mark) {
+    auto it = hedges.find(mark);
+    if (it == hedges.end()) {
+        return;
+    }
+    Task* twin = it->second;
+    hedges.erase(it);
+    CURL* e = twin->Curl();
+    curl_multi_remove_handle(cm, e);
+    easyHandles.Release(e);
+    delete twin;
+}
+
+void Excutor::Sample(const Task& task, Clock::time_point now) {
+    auto it = deadlines.find(task.Mark());
+    if (it == deadlines.end() || it->second.dispatchedAt == Clock::time_point()) {
+        //not a task that may hedge
+        return;
+    }
+    latencies[task.Url().Host()].Add(std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second.dispatchedAt).count());
+}
+
+void Excutor::Deliver(Task* task) {
+    if (callbacks == nullptr) {
+        /*Execute action indicate by user*/
+        task->Action()->Do(*task);
+        delete task;
+        return;
+    }
+    callbacks->Post([task] {
+        task->Action()->Do(*task);
+        delete task;
+    });
+}
+
+void Excutor::CheckMultiInfo() {
+    CURLMsg* msg;
+    int Q;
+    while ((msg = curl_multi_info_read(cm, &Q))) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        //msg is invalid once its handle is removed, read nothing more of it
+        Task* task;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &task);
+        CURLcode result = msg->data.result;
+        Clock::time_point now = Clock::now();
+        auto twin = hedges.find(task->Mark());
+        if (twin != hedges.end()) {
+            bool hedgeFinished = twin->second == task;
+            if (hedgeFinished) {
+                task = taskQueue.InFlight(task->Mark());
+            }
+            if (result != CURLE_OK) {
+                //the other transfer may still make it
+                if (hedgeFinished) {
+                    DropHedge(task->Mark());
+                } else {
+                    Adopt(*task);
+                }
+                continue;
+            }
+            if (hedgeFinished) {
+                ++hedgesWon;
+                Adopt(*task);
+            } else {
+                DropHedge(task->Mark());
+            }
+        }
+        if (result == CURLE_OK) {
+            Sample(*task, now);
+        }
+        if (Retryable(*task, result, now)) {
+            Retry(*task, now);
+            continue;
+        }
+        task->CurlCode(result);
+        if (result == CURLE_OPERATION_TIMEDOUT) {
+            task->Status(Response::TIMEDOUT);
+        }
+        Finish(task);
+    }
+}
+
+bool Excutor::StealFrom(Excutor& victim) {
+    std::lock(pendingMutex, victim.pendingMutex);
+    std::lock_guard<std::mutex> ownLock(pendingMutex, std::adopt_lock);
+    std::lock_guard<std::mutex> victimLock(victim.pendingMutex, std::adopt_lock);
+    size_t count = (victim.taskQueue.PendingSize() + 1) / 2;
+    for (size_t i = 0; i < count; ++i) {
+        Clock::time_point queuedAt;
+        Task* task = victim.taskQueue.Steal(queuedAt);
+        taskQueue.Push(task, queuedAt);
+        ArmTotal(*task, queuedAt);
+    }
+    //cancels the victim has not seen yet follow the stolen tasks
+    for (auto it = victim.cancels.begin(); it != victim.cancels.end();) {
+        if (taskQueue.IsPending(*it)) {
+            cancels.push_back(*it);
+            it = victim.cancels.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    victim.backlog = victim.taskQueue.PendingSize();
+    backlog = taskQueue.PendingSize();
+    return count > 0;
+}
+
+void Excutor::WakeIdlePeer() {
+    for (Excutor* peer : peers) {
+        if (peer != this && peer->Idle()) {
+            peer->Wake();
+            return;
+        }
+    }
+}
+
+/*Event driven excutor: sockets are registered by CURLMOPT_SOCKETFUNCTION and
+  driven by curl_multi_socket_action, so a turn costs O(ready sockets) instead of O(handles)*/
+void Excutor::Loop() {
+    std::vector<Poller::Event> ready;
+    Clock::time_point deadline = Clock::time_point::max();
+    Clock::time_point rateLimitedUntil = Clock::time_point::max();
+    std::vector<TimerWheel::Timer*> fired;
+    //tasks ended before libcurl finished them, by Cancel, a deadline or shedding
+    std::vector<Task*> pendingAborted, flyingAborted;
+    std::vector<long long> resumed;
+    int U = 0;
+    curl_multi_setopt(cm, CURLMOPT_TIMERDATA, &deadline);
+
+    while (true) {
+        if (optionsChanged) {
+            ApplyOptions();
+        }
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            Clock::time_point now = Clock::now();
+            while (Task* submitted = submissions.TryPop()) {
+                taskQueue.Push(submitted, now);
+                ArmTotal(*submitted, now);
+            }
+            if (!cancels.empty()) {
+                CollectCancelled(pendingAborted, flyingAborted);
+            }
+            resumed.swap(resumes);
+            pendingAborted.insert(pendingAborted.end(), dropped.begin(), dropped.end());
+            dropped.clear();
+            timers.Advance(now, fired);
+            if (!fired.empty()) {
+                CollectExpired(fired, now, pendingAborted, flyingAborted);
+                fired.clear();
+            }
+            while ((maxConcurrency == 0 || active < (int)maxConcurrency) && taskQueue.HasUnhandledTask()) {
+                Task* task = taskQueue.FrontUnhandledTask(now);
+                if (task == nullptr) {
+                    //every waiting host is rate limited
+                    rateLimitedUntil = taskQueue.NextReady();
+                    break;
+                }
+                admission.Leave(Admission::Footprint(*task));
+                Init(*task);
+                ArmIdle(*task, now);
+                ArmHedge(*task, now);
+                ++active;
+                retryTokens = std::min(retryBudget.burst, retryTokens + retryBudget.ratio);
+                hedgeTokens = std::min(hedgeBudget.burst, hedgeTokens + hedgeBudget.ratio);
+            }
+            backlog = taskQueue.PendingSize();
+        }
+        for (Task* task : pendingAborted) {
+            Forget(task->Mark());
+            Deliver(task);
+        }
+        for (Task* task : flyingAborted) {
+            Finish(task);
+        }
+        pendingAborted.clear();
+        flyingAborted.clear();
+        //outside pendingMutex, OnData may call Router::Resume
+        ResumePaused(resumed);
+        resumed.clear();
+        if (backlog > 0) {
+            WakeIdlePeer();
+        } else if (active == 0) {
+            //announce idleness before looking at peers, so a peer growing a backlog either sees us idle or is seen
+            idle = true;
+            bool stolen = false;
+            for (Excutor* peer : peers) {
+                if (peer != this && peer->Backlog() > 0 && StealFrom(*peer)) {
+                    stolen = true;
+                    break;
+                }
+            }
+            if (stolen) {
+                idle = false;
+                continue;
+            }
+        }
+        long waitMs = -1;
+        Clock::time_point wakeAt = std::min(std::min(deadline, rateLimitedUntil), timers.NextExpiry());
+        rateLimitedUntil = Clock::time_point::max();
+        if (wakeAt != Clock::time_point::max()) {
+            //round up, waking early for a token would spin
+            waitMs = (long)std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - Clock::now() + std::chrono::microseconds(999)).count());
+        }
+        //idle excutor blocks here until Router::Run or a busy peer wakes it
+        if (poller.Wait(waitMs, ready) < 0) {
+            fprintf(stderr, "E: poll(%li): %i: %s\n", waitMs, errno, strerror(errno));
+            return;
+        }
+        idle = false;
+        for (auto const& event : ready) {
+            if (event.socket == waker.Socket()) {
+                waker.Drain();
+                continue;
+            }
+            int evBitmask = (event.events & Poller::IN ? CURL_CSELECT_IN : 0)
+                            | (event.events & Poller::OUT ? CURL_CSELECT_OUT : 0)
+                            | (event.events & Poller::ERR ? CURL_CSELECT_ERR : 0);
+            curl_multi_socket_action(cm, event.socket, evBitmask, &U);
+        }
+        if (deadline != Clock::time_point::max() && Clock::now() >= deadline) {
+            deadline = Clock::time_point::max();
+            curl_multi_socket_action(cm, CURL_SOCKET_TIMEOUT, 0, &U);
+        }
+        CheckMultiInfo();
+    }
+}
+
+}
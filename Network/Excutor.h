@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include "Network/Router.h"
+#include "Poller.h"
+#include "TaskQueue.h"
+#include "TimerWheel.h"
+#include "EasyHandlePool.h"
+#include "ShareCache.h"
+#include "Admission.h"
+#include "LatencyHistogram.h"
+
+namespace Http {
+/*Excutor is one shard of the Router: a thread driving its own multi handle.
+  Tasks are submitted to its lock-free ring, an idle excutor steals pending
+  tasks from a busy peer.*/
+class Excutor {
+public:
+    //callbacks runs Action::Do when not null
+    Excutor(std::vector<Excutor*>& peers, const ShareCache& share, Admission& admission, CallbackExecutor* callbacks,
+            const RouterOptions& options);
+    ~Excutor();
+    Excutor(const Excutor&) = delete;
+    Excutor& operator=(const Excutor&) = delete;
+    void Start();
+    //any thread, false if the ring is full
+    bool Submit(Task* task);
+    //any thread, all of tasks or none, at most SubmissionCapacity at once
+    bool Submit(Task* const* tasks, size_t count);
+    size_t SubmissionCapacity() const;
+    void Wake();
+    //pending tasks not yet handed to libcurl, readable from any thread
+    size_t Backlog() const;
+    bool Idle() const;
+    const EasyHandlePool& EasyHandles() const;
+    const TaskQueue& Tasks() const;
+    //any thread, applied by the excutor thread on its next turn
+    void Configure(const RouterOptions& options);
+    //any thread, cancels the task if this excutor holds it
+    void Cancel(long long mark);
+    //any thread, unpauses the transfer of mark if this excutor runs it
+    void Resume(long long mark);
+    //any thread, see TaskQueue::Sheddable
+    bool Sheddable(int priority, int& victimPriority, Clock::time_point& queuedAt);
+    //any thread, drop the oldest pending task of class priority, its Action runs on this excutor
+    bool Shed(int priority);
+    //readable from any thread
+    void Stats(RouterStats& stats) const;
+private:
+    void Loop();
+    void Init(Task& unhandledTask);
+    void CheckMultiInfo();
+    //detach an in-flight task from libcurl, run its action and free it
+    void Finish(Task* task);
+    //true if the failed attempt of task is worth another, the budget allowing
+    bool Retryable(Task& task, CURLcode code, Clock::time_point now);
+    //detach task from libcurl and arm its retry timer, the task keeps its slot
+    void Retry(Task& task, Clock::time_point now);
+    //a task whose retry timer fired goes back to libcurl
+    void Redispatch(Task& task, Clock::time_point now);
+    //arm the hedge timer of a GET just handed to libcurl, if its policy hedges
+    void ArmHedge(const Task& task, Clock::time_point now);
+    //send the second transfer of task, the budget allowing
+    void Hedge(Task& task);
+    //task takes over the transfer and body of its hedge, aborting its own transfer
+    void Adopt(Task& task);
+    //abort the hedge of mark, if any
+    void DropHedge(long long mark);
+    //latency sample of a task finishing with CURLE_OK
+    void Sample(const Task& task, Clock::time_point now);
+    //run the action of a task leaving this excutor, here or on callbacks, and free it
+    void Deliver(Task* task);
+    //give the task of mark status and code and hand it to the matching list,
+    //false if this excutor does not hold it. Called with pendingMutex held
+    bool Collect(long long mark, Response::STATUS status, CURLcode code, std::vector<Task*>& pendingAborted, std::vector<Task*>& flyingAborted);
+    //unpause the transfers named by resumed, OnData may run meanwhile
+    void ResumePaused(const std::vector<long long>& resumed);
+    //pending and in-flight tasks named by cancels, called with pendingMutex held
+    void CollectCancelled(std::vector<Task*>& pendingAborted, std::vector<Task*>& flyingAborted);
+    //tasks whose timer fired and passed its deadline, called with pendingMutex held
+    void CollectExpired(const std::vector<TimerWheel::Timer*>& fired, Clock::time_point now, std::vector<Task*>& pendingAborted, std::vector<Task*>& flyingAborted);
+    //total deadline counts from queuedAt, idle one from dispatch
+    void ArmTotal(const Task& task, Clock::time_point queuedAt);
+    void ArmIdle(const Task& task, Clock::time_point now);
+    //drop the timers of a task leaving this excutor
+    void Forget(long long mark);
+    //move up to half of victim's backlog into our pending queue
+    bool StealFrom(Excutor& victim);
+    void WakeIdlePeer();
+    void ApplyOptions();
+private:
+    enum TIMER : int {
+        TOTAL = 0,
+        IDLE = 1,
+        RETRY = 2,
+        HEDGE = 3
+    };
+    /*timers of one task, Timer::mark names the task*/
+    struct Deadline {
+        Deadline() : idleMs(0), transferred(0), retries(0) {}
+        TimerWheel::Timer total;
+        TimerWheel::Timer idle;
+        TimerWheel::Timer retry;
+        TimerWheel::Timer hedge;
+        //last dispatch of a task that may hedge, for its latency sample
+        Clock::time_point dispatchedAt;
+        long long idleMs;
+        //bytes moved when the idle timer was armed
+        double transferred;
+        int retries;
+    };
+    std::vector<Excutor*>& peers;
+    const ShareCache& share;
+    Admission& admission;
+    CallbackExecutor* callbacks;
+    SubmissionQueue submissions;
+    Waker waker;
+    Poller poller;
+    CURLM* cm;
+    EasyHandlePool easyHandles;
+    //pending part of taskQueue, cancels and dropped are shared with stealing peers and submitters
+    std::mutex pendingMutex;
+    TaskQueue taskQueue;
+    std::vector<long long> cancels;
+    std::vector<long long> resumes;
+    //shed by submitters, waiting for their Action
+    std::vector<Task*> dropped;
+    //deadlines of the tasks this excutor holds, touched by its own thread only.
+    //A stolen task leaves its total timer behind, it is dropped when it fires
+    TimerWheel timers;
+    std::unordered_map<long long, Deadline> deadlines;
+    std::atomic<size_t> backlog;
+    std::atomic<bool> idle;
+    int active;
+    //limits of this excutor, its share of the Router wide ones
+    size_t maxConcurrency;
+    bool multiplex;
+    bool http2PriorKnowledge;
+    long long connectTimeoutMs;
+    long long timeoutMs;
+    long long idleTimeoutMs;
+    RetryPolicy retry;
+    //retry tokens, refilled by dispatches and by time, touched by the excutor thread only
+    RetryBudget retryBudget;
+    double retryTokens;
+    Clock::time_point retryRefilledAt;
+    std::mt19937 jitter;
+    std::atomic<unsigned long long> retries;
+    std::atomic<unsigned long long> retriesDenied;
+    //second transfers of in-flight tasks, keyed and marked like them. They are not in
+    //taskQueue and take no concurrency slot
+    std::unordered_map<long long, Task*> hedges;
+    HedgePolicy hedge;
+    RetryBudget hedgeBudget;
+    double hedgeTokens;
+    //recent latencies by URL::Host, hedge delays are their percentiles
+    std::unordered_map<std::string, LatencyHistogram> latencies;
+    std::atomic<unsigned long long> hedgesSent;
+    std::atomic<unsigned long long> hedgesWon;
+    std::mutex optionsMutex;
+    RouterOptions pendingOptions;
+    std::atomic<bool> optionsChanged;
+};
+
+}
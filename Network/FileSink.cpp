@@ -0,0 +1,296 @@
+﻿#include "stdafx.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "FileSink.h"
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <cerrno>
+#endif
+
+namespace Http {
+
+static char* AlignedAlloc(size_t size) {
+    #ifdef _WIN32
+    return (char*)_aligned_malloc(size, FileSink::ALIGNMENT);
+    #else
+    void* addr = nullptr;
+    return posix_memalign(&addr, FileSink::ALIGNMENT, size) == 0 ? (char*)addr : nullptr;
+    #endif
+}
+
+static void AlignedFree(char* addr) {
+    #ifdef _WIN32
+    _aligned_free(addr);
+    #else
+    free(addr);
+    #endif
+}
+
+static size_t AlignUp(size_t size) {
+    return (size + FileSink::ALIGNMENT - 1) / FileSink::ALIGNMENT * FileSink::ALIGNMENT;
+}
+
+FileSink::FileSink(const std::string& path, const DownloadOptions& options)
+    : path(path), options(options), file(-1), tried(false), writers(0), failed(false), length(0) {
+}
+
+FileSink::~FileSink() {
+    Close();
+}
+
+const DownloadOptions& FileSink::Options() const {
+    return options;
+}
+
+void FileSink::Attach() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++writers;
+}
+
+bool FileSink::Open() {
+    if (tried) {
+        return file != -1;
+    }
+    tried = true;
+    #ifdef _WIN32
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    if (options.direct) {
+        handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                             flags | FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+    }
+    if (handle == INVALID_HANDLE_VALUE) {
+        handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+    }
+    file = (intptr_t)handle;
+    #else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd = -1;
+    #ifdef O_DIRECT
+    if (options.direct) {
+        //refused with EINVAL by file systems without direct I/O, tmpfs among them
+        fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    }
+    #endif
+    if (fd < 0) {
+        fd = open(path.c_str(), flags, 0644);
+    }
+    file = fd;
+    #endif
+    return file != -1;
+}
+
+void FileSink::Close() {
+    if (file == -1) {
+        return;
+    }
+    #ifdef _WIN32
+    CloseHandle((HANDLE)file);
+    #else
+    close((int)file);
+    #endif
+    file = -1;
+}
+
+bool FileSink::Reserve(unsigned long long size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!Open()) {
+        return false;
+    }
+    #ifdef _WIN32
+    //extends the file, Detach cuts it back to the length received
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+    return SetFilePointerEx((HANDLE)file, end, NULL, FILE_BEGIN) && SetEndOfFile((HANDLE)file);
+    #elif defined(__linux__)
+    return fallocate((int)file, 0, 0, (off_t)size) == 0;
+    #else
+    return true;
+    #endif
+}
+
+bool FileSink::Write(unsigned long long offset, const char* data, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!Open()) {
+            return false;
+        }
+    }
+    #ifdef _WIN32
+    while (size > 0) {
+        OVERLAPPED at = {};
+        at.Offset = (DWORD)offset;
+        at.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD done = 0;
+        if (!WriteFile((HANDLE)file, data, (DWORD)std::min<size_t>(size, 1 << 30), &done, &at) || done == 0) {
+            return false;
+        }
+        data += done;
+        offset += done;
+        size -= done;
+    }
+    return true;
+    #else
+    unsigned long long start = offset;
+    size_t total = size;
+    while (size > 0) {
+        ssize_t done = pwrite((int)file, data, size, (off_t)offset);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        data += done;
+        offset += done;
+        size -= done;
+    }
+    #ifdef __linux__
+    if (options.writeBehind) {
+        //start writing this block back, wait for the one before and drop it
+        size_t block = AlignUp(std::max<size_t>(1, options.chunkBytes));
+        sync_file_range((int)file, (off_t)start, (off_t)total, SYNC_FILE_RANGE_WRITE);
+        if (start >= block) {
+            sync_file_range((int)file, (off_t)(start - block), (off_t)block,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise((int)file, (off_t)(start - block), (off_t)block, POSIX_FADV_DONTNEED);
+        }
+    }
+    #endif
+    return true;
+    #endif
+}
+
+bool FileSink::Detach(bool ok, unsigned long long end) {
+    std::lock_guard<std::mutex> lock(mutex);
+    failed = failed || !ok;
+    length = std::max(length, end);
+    if (--writers > 0) {
+        return !failed;
+    }
+    //an empty body was never written, it still makes a file
+    bool finished = !failed && Open();
+    if (finished) {
+        #ifdef _WIN32
+        LARGE_INTEGER at;
+        at.QuadPart = (LONGLONG)length;
+        finished = SetFilePointerEx((HANDLE)file, at, NULL, FILE_BEGIN) && SetEndOfFile((HANDLE)file);
+        #else
+        finished = ftruncate((int)file, (off_t)length) == 0;
+        #endif
+    }
+    Close();
+    if (!finished) {
+        remove(path.c_str());
+    }
+    return finished;
+}
+
+FileWriter::FileWriter(const std::shared_ptr<FileSink>& sink, unsigned long long offset, Action* action, bool ranged)
+    : sink(sink), offset(offset), action(action), ranged(ranged), buffer(nullptr), capacity(AlignUp(std::max<size_t>(1, sink->Options().chunkBytes))),
+      filled(0), written(0), started(false), discard(false), failed(false) {
+    sink->Attach();
+}
+
+FileWriter::~FileWriter() {
+    AlignedFree(buffer);
+}
+
+int FileWriter::OnData(const char* data, size_t size, const Task& task) {
+    if (!started) {
+        started = true;
+        long responseCode = 0;
+        curl_easy_getinfo(task.Curl(), CURLINFO_RESPONSE_CODE, &responseCode);
+        discard = ranged ? responseCode != 206 : responseCode / 100 != 2;
+        #if LIBCURL_VERSION_NUM >= 0x073700
+        curl_off_t length = -1;
+        curl_easy_getinfo(task.Curl(), CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        #else
+        double length = -1;
+        curl_easy_getinfo(task.Curl(), CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length);
+        #endif
+        if (!discard && length > 0 && sink->Options().preallocate) {
+            //a file system without fallocate is written without
+            sink->Reserve(offset + (unsigned long long)length);
+        }
+        buffer = discard ? nullptr : AlignedAlloc(capacity);
+        failed = !discard && buffer == nullptr;
+    }
+    if (discard) {
+        //a whole body where a range was asked for is not worth reading
+        long responseCode = 0;
+        curl_easy_getinfo(task.Curl(), CURLINFO_RESPONSE_CODE, &responseCode);
+        return ranged && responseCode / 100 == 2 ? ABORT : CONTINUE;
+    }
+    while (size > 0 && !failed) {
+        size_t n = std::min(size, capacity - filled);
+        memcpy(buffer + filled, data, n);
+        filled += n;
+        data += n;
+        size -= n;
+        if (filled == capacity) {
+            Flush();
+        }
+    }
+    return failed ? ABORT : CONTINUE;
+}
+
+bool FileWriter::Flush() {
+    if (filled == 0) {
+        return true;
+    }
+    size_t size = filled;
+    if (sink->Options().direct) {
+        size = AlignUp(filled);
+        memset(buffer + filled, 0, size - filled);
+    }
+    failed = !sink->Write(offset + written, buffer, size) || failed;
+    written += filled;
+    filled = 0;
+    return !failed;
+}
+
+void FileWriter::Do(const Task& task) {
+    Task& response = const_cast<Task&>(task);
+    bool expected = ranged ? response.ResponseCode() == 206 : response.ResponseCode() / 100 == 2;
+    if (ranged && !expected && response.ResponseCode() / 100 == 2 && response.Status() == Response::DONE) {
+        //a 200 to a range, aborted by OnData: If-Range failed as the entity changed
+        response.CurlCode(CURLE_RANGE_ERROR);
+    }
+    bool ok = response.Status() == Response::DONE && response.CurlCode() == CURLE_OK && !discard && expected;
+    if (ok && !Flush()) {
+        response.CurlCode(CURLE_WRITE_ERROR);
+    }
+    ok = ok && !failed;
+    if (!sink->Detach(ok, offset + written) && ok) {
+        response.CurlCode(CURLE_WRITE_ERROR);
+    }
+    Action* target = action;
+    response.Action(target);
+    delete this;
+    target->Do(response);
+}
+
+int FileWriter::Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) {
+    return action->Progress(totaltime, dltotal, dlnow, ultotal, ulnow, task);
+}
+
+double FileWriter::ProgressInterval() const {
+    return action->ProgressInterval();
+}
+
+void FileWriter::ProgressInterval(double val) {
+    action->ProgressInterval(val);
+}
+
+float FileWriter::LastTime() const {
+    return action->LastTime();
+}
+
+void FileWriter::LastTime(float val) {
+    action->LastTime(val);
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <memory>
+#include <string>
+#include "Network/Router.h"
+
+namespace Http {
+/*FileSink is the file a download is written to, see Router::Download. It is opened on
+  the first write and finished once every FileWriter writing into it has left: cut to
+  the length received, or removed if any of them failed.*/
+class FileSink {
+public:
+    //offsets and sizes of writes with DownloadOptions::direct are multiples of this
+    static const size_t ALIGNMENT = 4096;
+    FileSink(const std::string& path, const DownloadOptions& options);
+    ~FileSink();
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+    const DownloadOptions& Options() const;
+    //a writer joins, before any has left
+    void Attach();
+    //any thread: allocate the first size bytes of the file
+    bool Reserve(unsigned long long size);
+    //any thread: write size bytes of data at offset
+    bool Write(unsigned long long offset, const char* data, size_t size);
+    //any thread: a writer leaves having received the body up to end. The last one
+    //finishes the file. False once a writer failed or the file could not be finished
+    bool Detach(bool ok, unsigned long long end);
+private:
+    //open the file once, called with mutex held
+    bool Open();
+    void Close();
+private:
+    std::mutex mutex;
+    std::string path;
+    DownloadOptions options;
+    //an fd, a HANDLE on Windows, -1 while closed
+    intptr_t file;
+    bool tried;
+    size_t writers;
+    bool failed;
+    unsigned long long length;
+};
+
+/*the Action of a transfer writing its body at offset of a FileSink. OnData gathers the
+  chunks into blocks of DownloadOptions::chunkBytes, each written at once. It hands the
+  task to the caller's Action and frees itself after Do. A ranged one takes only a 206*/
+class FileWriter : public Action {
+public:
+    FileWriter(const std::shared_ptr<FileSink>& sink, unsigned long long offset, Action* action, bool ranged = false);
+    ~FileWriter();
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+    virtual void Do(const Task& task) override;
+    virtual int Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) override;
+    virtual int OnData(const char* data, size_t size, const Task& task) override;
+    virtual double ProgressInterval() const override;
+    virtual void ProgressInterval(double val) override;
+    virtual float LastTime() const override;
+    virtual void LastTime(float val) override;
+private:
+    //write the gathered block, padded to ALIGNMENT with DownloadOptions::direct
+    bool Flush();
+private:
+    std::shared_ptr<FileSink> sink;
+    unsigned long long offset;
+    Action* action;
+    bool ranged;
+    char* buffer;
+    size_t capacity;
+    size_t filled;
+    //body bytes before the buffered ones
+    unsigned long long written;
+    bool started;
+    //the body of an error status is not written
+    bool discard;
+    bool failed;
+};
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+
+namespace Http {
+/*Latencies of recent transfers in logarithmic buckets, PER_DOUBLING of them per
+  doubling from 1ms, so a percentile is known within ~19%. Counts halve every
+  DECAY samples and the estimate follows a host that speeds up or slows down.
+  Single threaded, owned by one excutor.*/
+class LatencyHistogram {
+public:
+    enum : int {
+        PER_DOUBLING = 4,
+        //up to 2^20 ms
+        BUCKETS = 20 * PER_DOUBLING + 1,
+        DECAY = 1024
+    };
+    LatencyHistogram() : count(0), sinceDecay(0) {
+        std::fill(counts, counts + BUCKETS, 0);
+    }
+    void Add(long long ms) {
+        ++counts[BucketOf(ms)];
+        ++count;
+        if (++sinceDecay >= DECAY) {
+            count = 0;
+            for (int i = 0; i < BUCKETS; ++i) {
+                counts[i] /= 2;
+                count += counts[i];
+            }
+            sinceDecay = 0;
+        }
+    }
+    size_t Count() const {
+        return count;
+    }
+    //upper bound of the bucket holding the p-th fraction of samples, 0 if there are none
+    long long Percentile(double p) const {
+        size_t rank = (size_t)std::ceil(std::min(1.0, std::max(0.0, p)) * count);
+        size_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank && seen > 0) {
+                return UpperBound(i);
+            }
+        }
+        return 0;
+    }
+private:
+    //bucket i > 0 holds [2^((i-1)/PER_DOUBLING), 2^(i/PER_DOUBLING)) ms
+    static int BucketOf(long long ms) {
+        if (ms < 1) {
+            return 0;
+        }
+        return std::min<int>(BUCKETS - 1, 1 + (int)(std::log2((double)ms) * PER_DOUBLING));
+    }
+    static long long UpperBound(int bucket) {
+        return (long long)std::ceil(std::pow(2.0, (double)bucket / PER_DOUBLING));
+    }
+private:
+    size_t counts[BUCKETS];
+    size_t count;
+    size_t sinceDecay;
+};
+
+}
@@ -0,0 +1,221 @@
+﻿#include "stdafx.h"
+#ifdef _WIN32
+    //select on windows watches 64 sockets by default, must be set before winsock2.h
+    #define FD_SETSIZE 4096
+#endif
+#include "Poller.h"
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+#endif
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <fcntl.h>
+#endif
+
+namespace Http {
+
+#ifdef __linux__
+
+Poller::Poller() : epfd(epoll_create1(EPOLL_CLOEXEC)) {
+}
+
+Poller::~Poller() {
+    if (epfd >= 0) {
+        close(epfd);
+    }
+}
+
+void Poller::Watch(curl_socket_t socket, int events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    if (events & IN) ev.events |= EPOLLIN;
+    if (events & OUT) ev.events |= EPOLLOUT;
+    ev.data.fd = socket;
+    auto it = sockets.find(socket);
+    if (it == sockets.end()) {
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, socket, &ev) == 0
+                || (errno == EEXIST && epoll_ctl(epfd, EPOLL_CTL_MOD, socket, &ev) == 0)) {
+            sockets[socket] = events;
+        }
+    } else if (it->second != events) {
+        epoll_ctl(epfd, EPOLL_CTL_MOD, socket, &ev);
+        it->second = events;
+    }
+}
+
+void Poller::Unwatch(curl_socket_t socket) {
+    if (sockets.erase(socket)) {
+        //socket may be closed already, the kernel then has removed it itself
+        epoll_ctl(epfd, EPOLL_CTL_DEL, socket, nullptr);
+    }
+}
+
+int Poller::Wait(long timeoutMs, std::vector<Event>& ready) {
+    ready.clear();
+    struct epoll_event evs[256];
+    int n = epoll_wait(epfd, evs, sizeof(evs) / sizeof(evs[0]), timeoutMs < 0 ? -1 : (int)timeoutMs);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; ++i) {
+        Event event = { evs[i].data.fd, NONE };
+        if (evs[i].events & (EPOLLIN | EPOLLHUP)) event.events |= IN;
+        if (evs[i].events & EPOLLOUT) event.events |= OUT;
+        if (evs[i].events & EPOLLERR) event.events |= ERR;
+        ready.push_back(event);
+    }
+    return n;
+}
+
+#else
+
+Poller::Poller() {
+}
+
+Poller::~Poller() {
+}
+
+void Poller::Watch(curl_socket_t socket, int events) {
+    sockets[socket] = events;
+}
+
+void Poller::Unwatch(curl_socket_t socket) {
+    sockets.erase(socket);
+}
+
+int Poller::Wait(long timeoutMs, std::vector<Event>& ready) {
+    ready.clear();
+    if (sockets.empty()) {
+        //select refuses empty sets on windows
+        if (timeoutMs < 0) {
+            timeoutMs = 100;
+        }
+        Sleep(timeoutMs);
+        return 0;
+    }
+    fd_set R, W, E;
+    FD_ZERO(&R);
+    FD_ZERO(&W);
+    FD_ZERO(&E);
+    curl_socket_t maxfd = 0;
+    for (auto const& watched : sockets) {
+        if (watched.second & IN) FD_SET(watched.first, &R);
+        if (watched.second & OUT) FD_SET(watched.first, &W);
+        FD_SET(watched.first, &E);
+        if (watched.first > maxfd) maxfd = watched.first;
+    }
+    struct timeval T;
+    T.tv_sec = timeoutMs / 1000;
+    T.tv_usec = (timeoutMs % 1000) * 1000;
+    int n = select((int)maxfd + 1, &R, &W, &E, timeoutMs < 0 ? nullptr : &T);
+    if (n <= 0) {
+        return n;
+    }
+    for (auto const& watched : sockets) {
+        Event event = { watched.first, NONE };
+        if (FD_ISSET(watched.first, &R)) event.events |= IN;
+        if (FD_ISSET(watched.first, &W)) event.events |= OUT;
+        if (FD_ISSET(watched.first, &E)) event.events |= ERR;
+        if (event.events != NONE) {
+            ready.push_back(event);
+        }
+    }
+    return (int)ready.size();
+}
+
+#endif
+
+size_t Poller::Size() const {
+    return sockets.size();
+}
+
+#ifdef _WIN32
+
+Waker::Waker() : readSocket(CURL_SOCKET_BAD), writeSocket(CURL_SOCKET_BAD) {
+    struct sockaddr_in addr;
+    int addrLen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    readSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (readSocket == CURL_SOCKET_BAD
+            || bind(readSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0
+            || getsockname(readSocket, (struct sockaddr*)&addr, &addrLen) != 0
+            || connect(readSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "E: waker socket: %i\n", WSAGetLastError());
+        return;
+    }
+    u_long nonblocking = 1;
+    ioctlsocket(readSocket, FIONBIO, &nonblocking);
+    writeSocket = readSocket;
+}
+
+Waker::~Waker() {
+    if (readSocket != CURL_SOCKET_BAD) {
+        closesocket(readSocket);
+    }
+}
+
+void Waker::Wake() {
+    char one = 1;
+    send(writeSocket, &one, 1, 0);
+}
+
+void Waker::Drain() {
+    char buf[64];
+    while (recv(readSocket, buf, sizeof(buf), 0) > 0) {
+    }
+}
+
+#else
+
+Waker::Waker() : readSocket(CURL_SOCKET_BAD), writeSocket(CURL_SOCKET_BAD) {
+    #ifdef __linux__
+    readSocket = writeSocket = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    #else
+    int fds[2];
+    if (pipe(fds) == 0) {
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        readSocket = fds[0];
+        writeSocket = fds[1];
+    }
+    #endif
+    if (readSocket == CURL_SOCKET_BAD) {
+        fprintf(stderr, "E: waker: %i: %s\n", errno, strerror(errno));
+    }
+}
+
+Waker::~Waker() {
+    if (readSocket != CURL_SOCKET_BAD) {
+        close(readSocket);
+    }
+    if (writeSocket != readSocket && writeSocket != CURL_SOCKET_BAD) {
+        close(writeSocket);
+    }
+}
+
+void Waker::Wake() {
+    #ifdef __linux__
+    uint64_t one = 1;
+    #else
+    char one = 1;
+    #endif
+    ssize_t written = write(writeSocket, &one, sizeof(one));
+    (void)written;
+}
+
+void Waker::Drain() {
+    char buf[64];
+    while (read(readSocket, buf, sizeof(buf)) > 0) {
+    }
+}
+
+#endif
+
+curl_socket_t Waker::Socket() const {
+    return readSocket;
+}
+
+}
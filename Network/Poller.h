@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <map>
+#include "Network/curl/curl.h"
+
+namespace Http {
+/*Poller waits for readiness of the sockets libcurl asks us to watch.
+  epoll on linux, select with an enlarged FD_SETSIZE elsewhere*/
+class Poller {
+public:
+    enum EVENT : int {
+        NONE = 0,
+        IN = 1,
+        OUT = 2,
+        ERR = 4
+    };
+    struct Event {
+        curl_socket_t socket;
+        int events;
+    };
+public:
+    Poller();
+    ~Poller();
+    Poller(const Poller&) = delete;
+    Poller& operator=(const Poller&) = delete;
+    //add or modify interest of socket
+    void Watch(curl_socket_t socket, int events);
+    void Unwatch(curl_socket_t socket);
+    //block at most timeoutMs(-1 means forever), fill ready with sockets which have events
+    int Wait(long timeoutMs, std::vector<Event>& ready);
+    size_t Size() const;
+private:
+    std::map<curl_socket_t, int> sockets;
+    #ifdef __linux__
+    int epfd;
+    #endif
+};
+
+/*Waker interrupts Poller::Wait from another thread: eventfd on linux,
+  a self connected loopback udp socket on windows, a pipe elsewhere*/
+class Waker {
+public:
+    Waker();
+    ~Waker();
+    Waker(const Waker&) = delete;
+    Waker& operator=(const Waker&) = delete;
+    //socket to watch for Poller::IN
+    curl_socket_t Socket() const;
+    void Wake();
+    //consume pending wakeups, called by the waiting thread
+    void Drain();
+private:
+    curl_socket_t readSocket;
+    curl_socket_t writeSocket;
+};
+
+}
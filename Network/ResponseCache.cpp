@@ -0,0 +1,276 @@
+﻿#include "stdafx.h"
+#include <ctime>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include "ResponseCache.h"
+
+namespace Http {
+
+void ResponseCache::Filler::Do(const Task& task) {
+    Task& response = const_cast<Task&>(task);
+    if (response.Status() == Response::DONE && response.CurlCode() == CURLE_OK) {
+        if (response.ResponseCode() == 304) {
+            owner.Revalidate(key, response, pinned);
+        } else if (response.ResponseCode() == 200) {
+            owner.Store(key, response);
+        }
+    }
+    Action* target = action;
+    response.Action(target);
+    delete this;
+    target->Do(response);
+}
+
+int ResponseCache::Filler::Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) {
+    return action->Progress(totaltime, dltotal, dlnow, ultotal, ulnow, task);
+}
+
+double ResponseCache::Filler::ProgressInterval() const {
+    return action->ProgressInterval();
+}
+
+void ResponseCache::Filler::ProgressInterval(double val) {
+    action->ProgressInterval(val);
+}
+
+float ResponseCache::Filler::LastTime() const {
+    return action->LastTime();
+}
+
+void ResponseCache::Filler::LastTime(float val) {
+    action->LastTime(val);
+}
+
+void ResponseCache::Capacity(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = bytes;
+    Evict();
+}
+
+void ResponseCache::Disk(const std::string& directory, size_t bytes) {
+    std::lock_guard<std::mutex> lock(diskMutex);
+    if (directory == diskPath && bytes == diskBytes) {
+        return;
+    }
+    diskPath = directory;
+    diskBytes = bytes;
+    disk.Open(directory, bytes);
+}
+
+bool ResponseCache::Serve(Task& task) {
+    std::string key = task.Url().Canonical();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end() && Clock::now() < it->second->expiresAt) {
+            entries.splice(entries.begin(), entries, it->second);
+            Lend(*it->second, task);
+            ++hits;
+            return true;
+        }
+    }
+    DiskCache::View view;
+    if (disk.Find(key, view) && view.fresh) {
+        Lend(view, task);
+        ++hits;
+        ++diskHits;
+        return true;
+    }
+    ++misses;
+    return false;
+}
+
+void ResponseCache::Fill(Task& task) {
+    std::string key = task.Url().Canonical();
+    RequestOptions options = task.Options();
+    options.keepHeaders = true;
+    task.Options(options);
+    DiskCache::View view;
+    view.addr = nullptr;
+    view.size = 0;
+    view.fresh = false;
+    bool known = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            const Entry& entry = *it->second;
+            view.addr = entry.body.get();
+            view.size = entry.size;
+            view.owner = entry.body;
+            view.headers = entry.headers;
+            view.etag = entry.etag;
+            view.lastModified = entry.lastModified;
+            known = true;
+        }
+    }
+    if (!known) {
+        disk.Find(key, view);
+    }
+    if (!view.etag.empty()) {
+        task.Headers().push_back("If-None-Match: " + view.etag);
+    }
+    if (!view.lastModified.empty()) {
+        task.Headers().push_back("If-Modified-Since: " + view.lastModified);
+    }
+    task.Action(new Filler(*this, key, task.Action(), view));
+}
+
+void ResponseCache::Store(const std::string& key, Task& task) {
+    long long seconds = 0;
+    if (task.Borrowed() || !Freshness(task, seconds)) {
+        return;
+    }
+    Entry entry;
+    entry.key = key;
+    entry.size = task.Size();
+    entry.headers = task.ResponseHeaders();
+    entry.etag = task.Header("ETag");
+    entry.lastModified = task.Header("Last-Modified");
+    entry.expiresAt = Clock::now() + std::chrono::seconds(std::max(0LL, seconds));
+    //neither fresh nor revalidatable, an entry would never be used
+    if (seconds <= 0 && entry.etag.empty() && entry.lastModified.empty()) {
+        return;
+    }
+    disk.Store(key, task.MemoryAddr(), entry.size, entry.headers, entry.etag, entry.lastModified, seconds);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (Cost(entry) > capacity) {
+        return;
+    }
+    //the body moves into the cache and is lent back to task
+    char* addr = task.MemoryAddr();
+    task.MemoryAddr(nullptr);
+    entry.body = std::shared_ptr<char>(addr, free);
+    task.Borrow(addr, entry.size, entry.body);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        size -= Cost(*it->second);
+        entries.erase(it->second);
+    }
+    entries.push_front(std::move(entry));
+    index[key] = entries.begin();
+    size += Cost(entries.front());
+    Evict();
+}
+
+void ResponseCache::Revalidate(const std::string& key, Task& task, const DiskCache::View& pinned) {
+    long long seconds = 0;
+    bool storable = Freshness(task, seconds);
+    std::string etag = task.Header("ETag");
+    if (storable) {
+        disk.Refresh(key, seconds);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            Entry& entry = *it->second;
+            if (!storable) {
+                size -= Cost(entry);
+                Lend(entry, task);
+                entries.erase(it->second);
+                index.erase(it);
+                ++revalidated;
+                return;
+            }
+            size -= Cost(entry);
+            if (!etag.empty()) {
+                entry.etag = etag;
+            }
+            size += Cost(entry);
+            entry.expiresAt = Clock::now() + std::chrono::seconds(std::max(0LL, seconds));
+            entries.splice(entries.begin(), entries, it->second);
+            Lend(entry, task);
+            ++revalidated;
+            Evict();
+            return;
+        }
+    }
+    DiskCache::View view;
+    if (disk.Find(key, view)) {
+        Lend(view, task);
+        ++diskHits;
+    } else if (pinned.owner) {
+        //evicted since the request went out, the body validated is still pinned
+        Lend(pinned, task);
+    } else {
+        //no validator was sent, the 304 is the server's own
+        return;
+    }
+    ++revalidated;
+}
+
+bool ResponseCache::Freshness(const Response& response, long long& seconds) {
+    std::string cacheControl = response.Header("Cache-Control");
+    std::transform(cacheControl.begin(), cacheControl.end(), cacheControl.begin(), ::tolower);
+    if (cacheControl.find("no-store") != std::string::npos) {
+        return false;
+    }
+    seconds = 0;
+    if (cacheControl.find("no-cache") != std::string::npos) {
+        return true;
+    }
+    size_t maxAge = cacheControl.find("max-age=");
+    if (maxAge != std::string::npos) {
+        seconds = atoll(cacheControl.c_str() + maxAge + 8);
+    } else {
+        std::string expires = response.Header("Expires");
+        if (!expires.empty()) {
+            //an invalid date such as 0 means already expired
+            time_t expiresAt = curl_getdate(expires.c_str(), nullptr);
+            std::string date = response.Header("Date");
+            time_t now = date.empty() ? -1 : curl_getdate(date.c_str(), nullptr);
+            if (now < 0) {
+                now = time(nullptr);
+            }
+            seconds = expiresAt < 0 ? 0 : (long long)(expiresAt - now);
+        }
+    }
+    std::string age = response.Header("Age");
+    if (!age.empty()) {
+        seconds -= atoll(age.c_str());
+    }
+    return true;
+}
+
+size_t ResponseCache::Cost(const Entry& entry) {
+    return sizeof(Entry) + entry.key.size() + entry.size + entry.headers.size() + entry.etag.size() + entry.lastModified.size();
+}
+
+void ResponseCache::Lend(const Entry& entry, Task& task) {
+    task.Borrow(entry.body.get(), entry.size, entry.body);
+    task.ResponseCode(200);
+    task.CurlCode(CURLE_OK);
+    task.Status(Response::DONE);
+    if (task.Options().keepHeaders) {
+        task.ResponseHeaders() = entry.headers;
+    }
+}
+
+void ResponseCache::Lend(const DiskCache::View& view, Task& task) {
+    task.Borrow(view.addr, view.size, view.owner);
+    task.ResponseCode(200);
+    task.CurlCode(CURLE_OK);
+    task.Status(Response::DONE);
+    if (task.Options().keepHeaders) {
+        task.ResponseHeaders() = view.headers;
+    }
+}
+
+void ResponseCache::Evict() {
+    while (size > capacity && !entries.empty()) {
+        size -= Cost(entries.back());
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+void ResponseCache::Stats(RouterStats& stats) const {
+    stats.cacheHits = hits;
+    stats.cacheMisses = misses;
+    stats.cacheRevalidated = revalidated;
+    stats.cacheDiskHits = diskHits;
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include "Network/Router.h"
+#include "DiskCache.h"
+
+namespace Http {
+/*ResponseCache keeps 200 responses to GET by URL::Canonical in LRU order, bounded
+  in bytes, see RouterOptions::cacheBytes. Bodies are shared with the responses
+  handed out, an entry evicted meanwhile stays alive until they are freed. Behind it
+  an optional DiskCache, see RouterOptions::diskCachePath.*/
+class ResponseCache {
+public:
+    typedef std::chrono::steady_clock Clock;
+    ResponseCache() : capacity(0), size(0), hits(0), misses(0), revalidated(0), diskHits(0), diskBytes(0) {}
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+    //any thread, evicts down to bytes
+    void Capacity(size_t bytes);
+    //any thread, (re)opens the disk cache if directory or bytes changed, empty closes it
+    void Disk(const std::string& directory, size_t bytes);
+    //any thread: true if a fresh entry was lent to task, which is then complete
+    bool Serve(Task& task);
+    //any thread: ready a task going to the network, a stale entry's validators are sent
+    //and the response is stored or revalidated before task's Action sees it
+    void Fill(Task& task);
+    //readable from any thread
+    void Stats(RouterStats& stats) const;
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<char> body;
+        size_t size;
+        std::string headers;
+        std::string etag;
+        std::string lastModified;
+        Clock::time_point expiresAt;
+    };
+    typedef std::list<Entry> Entries;
+    /*the Action of a task filling the cache, wraps the caller's and frees itself after Do.
+      It pins the body the validators were taken from, a 304 still has it if evicted*/
+    class Filler : public Action {
+    public:
+        Filler(ResponseCache& owner, const std::string& key, Action* action, const DiskCache::View& pinned)
+            : owner(owner), key(key), action(action), pinned(pinned) {}
+        virtual void Do(const Task& task) override;
+        virtual int Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) override;
+        virtual double ProgressInterval() const override;
+        virtual void ProgressInterval(double val) override;
+        virtual float LastTime() const override;
+        virtual void LastTime(float val) override;
+    private:
+        ResponseCache& owner;
+        std::string key;
+        Action* action;
+        DiskCache::View pinned;
+    };
+    //store a 200 response if its headers allow, its body moves to the cache and is lent back
+    void Store(const std::string& key, Task& task);
+    //a 304 refreshes the entry and task borrows its body, the pinned one if it was evicted meanwhile
+    void Revalidate(const std::string& key, Task& task, const DiskCache::View& pinned);
+    //how long a response stays fresh, false if it must not be stored
+    static bool Freshness(const Response& response, long long& seconds);
+    static size_t Cost(const Entry& entry);
+    void Lend(const Entry& entry, Task& task);
+    void Lend(const DiskCache::View& view, Task& task);
+    void Evict();
+private:
+    mutable std::mutex mutex;
+    //most recently used first
+    Entries entries;
+    std::unordered_map<std::string, Entries::iterator> index;
+    size_t capacity;
+    size_t size;
+    std::atomic<unsigned long long> hits;
+    std::atomic<unsigned long long> misses;
+    std::atomic<unsigned long long> revalidated;
+    std::atomic<unsigned long long> diskHits;
+    DiskCache disk;
+    //guarded by diskMutex, what disk was opened with
+    std::mutex diskMutex;
+    std::string diskPath;
+    size_t diskBytes;
+};
+
+}
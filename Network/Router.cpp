@@ -3,8 +3,20 @@
 #include <memory>
 #include <list>
 #include <algorithm>
+#include <chrono>
+#include <mutex>
 #include <condition_variable>
+#include <cctype>
 #include "Network/Router.h"
+#include "Excutor.h"
+#include "ShareCache.h"
+#include "Admission.h"
+#include "CallbackPool.h"
+#include "Batch.h"
+#include "Coalescer.h"
+#include "ResponseCache.h"
+#include "FileSink.h"
+#include "Segmenter.h"
 
 namespace Http {
 
@@ -21,7 +33,7 @@ Memory::Memory(const Memory& memory)
 }
 
 Memory::Memory(Memory&& memory)
-    : memoryAddr(memory.memoryAddr), size(memory.size) {
+    : memoryAddr(memory.memoryAddr), size(memory.size), owner(std::move(memory.owner)) {
     memory.MemoryAddr(nullptr);
 }
 
@@ -49,28 +61,44 @@ void Memory::Size(size_t val) {
     size = val;
 }
 
+void Memory::Borrow(char* addr, size_t size, const std::shared_ptr<void>& owner) {
+    if (!Borrowed()) {
+        free(memoryAddr);
+    }
+    memoryAddr = addr;
+    this->size = size;
+    this->owner = owner;
+}
+
+bool Memory::Borrowed() const {
+    return owner != nullptr;
+}
+
 Memory::~Memory() {
-    free(MemoryAddr());
+    if (!Borrowed()) {
+        free(MemoryAddr());
+    }
     MemoryAddr(0);
 }
 
-Request::Request(const URL& url, Base* userData) : url(url), userData(userData), unhandled(true), updDatas(), type(TYPE::GET) {
+Request::Request(const URL& url, Base* userData) : url(url), userData(userData), unhandled(true), updDatas(), type(TYPE::GET), options() {
 }
 
 Request::Request(const URL& url, const std::vector<UploadedData>& uploadeddatas, Base* userData /*= nullptr*/)
-    : url(url), updDatas(uploadeddatas), userData(userData), type(TYPE::POST) {
+    : url(url), updDatas(uploadeddatas), userData(userData), unhandled(true), type(TYPE::POST), options() {
 
 }
 
 Request::Request(const Request& request)
     : url(request.Url()), userData(request.UserData()),
-      unhandled(request.Unhandled()), updDatas(request.updDatas), type(request.type) {
+      unhandled(request.Unhandled()), updDatas(request.updDatas), type(request.type), options(request.options), headers(request.headers) {
 }
 
 
 Request::Request(Request&& request)
     : url(std::move(request.url)), userData(request.userData),
-      unhandled(request.unhandled), updDatas(std::move(request.updDatas)), type(request.type) {
+      unhandled(request.unhandled), updDatas(std::move(request.updDatas)), type(request.type), options(request.options),
+      headers(std::move(request.headers)) {
     request.UserData(nullptr);
 }
 
@@ -139,14 +167,32 @@ void Request::Type(TYPE val) {
     #endif
 }
 
-Response::Response() : Memory(), curlCode(CURLE_OK), curl(nullptr), dltotal(0) {}
+const RequestOptions& Request::Options() const {
+    return options;
+}
+
+void Request::Options(const RequestOptions& val) {
+    options = val;
+}
+
+const std::vector<std::string>& Request::Headers() const {
+    return headers;
+}
+
+std::vector<std::string>& Request::Headers() {
+    return headers;
+}
+
+Response::Response() : Memory(), curlCode(CURLE_OK), curl(nullptr), status(DONE), responseCode(0), dltotal(0) {}
 
 Response::Response(const Response& response) : Memory(response), curlCode(response.CurlCode()),
-    curl(response.Curl()), dltotal(response.Dltotal()) {}
+    curl(response.Curl()), status(response.status), responseCode(response.responseCode), responseHeaders(response.responseHeaders),
+    dltotal(response.Dltotal()) {}
 
 
 Response::Response(Response&& response): Memory(std::move(response)), curlCode(response.curlCode),
-    curl(response.curl),  dltotal(response.dltotal) {
+    curl(response.curl), status(response.status), responseCode(response.responseCode), responseHeaders(std::move(response.responseHeaders)),
+    dltotal(response.dltotal) {
 
 }
 
@@ -177,6 +223,59 @@ void Response::Curl(CURL* val) {
     curl = val;
 }
 
+Response::STATUS Response::Status() const {
+    return status;
+}
+
+void Response::Status(STATUS val) {
+    status = val;
+}
+
+long Response::ResponseCode() const {
+    return responseCode;
+}
+
+void Response::ResponseCode(long val) {
+    responseCode = val;
+}
+
+const std::string& Response::ResponseHeaders() const {
+    return responseHeaders;
+}
+
+std::string& Response::ResponseHeaders() {
+    return responseHeaders;
+}
+
+std::string Response::Header(const std::string& name) const {
+    //interim 1xx responses and proxies may come first, the last status line starts the headers
+    size_t begin = 0;
+    for (size_t status = responseHeaders.find("HTTP/"); status != std::string::npos; status = responseHeaders.find("\nHTTP/", status + 1)) {
+        begin = status;
+    }
+    std::string value;
+    while (begin < responseHeaders.size()) {
+        size_t end = responseHeaders.find('\n', begin);
+        end = end == std::string::npos ? responseHeaders.size() : end;
+        size_t colon = responseHeaders.find(':', begin);
+        if (colon < end && colon - begin == name.size()
+                && std::equal(name.begin(), name.end(), responseHeaders.begin() + begin, [](char a, char b) {
+                    return ::tolower((unsigned char)a) == ::tolower((unsigned char)b);
+                })) {
+            size_t first = responseHeaders.find_first_not_of(" \t", colon + 1);
+            size_t last = responseHeaders.find_last_not_of(" \t\r", end - 1);
+            if (!value.empty()) {
+                value += ", ";
+            }
+            if (first != std::string::npos && last != std::string::npos && first <= last && first < end) {
+                value.append(responseHeaders, first, last - first + 1);
+            }
+        }
+        begin = end + 1;
+    }
+    return value;
+}
+
 bool Response::operator==(const Response&& response)const {
     if (Memory::operator==(static_cast < const Memory && > (response))) {
         return curlCode == response.curlCode && curl == response.curl;
@@ -236,234 +335,331 @@ void Task::Mark(long long val) {
     mark = val;
 }
 
-long long Task::markCouter = 0;
-volatile  bool g_createdExcutor = true;
+std::atomic<long long> Task::markCouter(0);
+std::once_flag g_createdExcutor;
 
-/*taskQueue maintains a task queue to perform task orderly*/
-class TaskQueue {
-public:
-    std::list<Task>::iterator FrontUnhandledTask() {
-        for (auto beg = std::begin(taskQueue); beg != std::end(taskQueue); ++beg) {
-            if (beg->Unhandled()) {
-                return beg;
-            }
-        }
-        return taskQueue.end();
+long long Router::Get(const URL& url, Action* httpAction, Base* userData /*= nullptr*/, const RequestOptions& options /*= RequestOptions()*/) {
+    Task task(url, httpAction, userData);
+    task.Options(options);
+    return Run(std::move(task));
+}
+
+long long Router::TryGet(const URL& url, Action* httpAction, Base* userData /*= nullptr*/, const RequestOptions& options /*= RequestOptions()*/) {
+    Task task(url, httpAction, userData);
+    task.Options(options);
+    return TryRun(std::move(task));
+}
+
+long long Router::Post(const URL& url, const std::vector<UploadedData>& uploadedDatas, Action* httpAction, Base* userData /*= nullptr*/, const RequestOptions& options /*= RequestOptions()*/) {
+    Task task(url, uploadedDatas, httpAction, userData);
+    task.Options(options);
+    return Run(std::move(task));
+}
+
+long long Router::TryPost(const URL& url, const std::vector<UploadedData>& uploadedDatas, Action* httpAction, Base* userData /*= nullptr*/, const RequestOptions& options /*= RequestOptions()*/) {
+    Task task(url, uploadedDatas, httpAction, userData);
+    task.Options(options);
+    return TryRun(std::move(task));
+}
+
+long long Router::Download(const URL& url, const std::string& path, Action* httpAction, Base* userData /*= nullptr*/,
+                           const RequestOptions& options /*= RequestOptions()*/, const DownloadOptions& download /*= DownloadOptions()*/) {
+    std::shared_ptr<FileSink> sink = std::make_shared<FileSink>(path, download);
+    if (download.segments > 1) {
+        return segmenter->Download(url, sink, httpAction, userData, options);
     }
-    bool HasUnhandledTask() {
-        return !(FrontUnhandledTask() == taskQueue.end());
+    FileWriter* writer = new FileWriter(sink, 0, httpAction);
+    Task task(url, writer, userData);
+    RequestOptions streamed = options;
+    streamed.stream = true;
+    task.Options(streamed);
+    long long mark = Run(std::move(task));
+    if (mark < 0) {
+        //refused, Do never runs
+        delete writer;
     }
+    return mark;
+}
 
-    void Push(Task&& task) {
-        taskQueue.push_back(std::move(task));
+long long Router::Run(Task&& task) {
+    return Submit(std::move(task), true);
+}
+
+long long Router::TryRun(Task&& task) {
+    return Submit(std::move(task), false);
+}
+
+void Router::Start() {
+    std::call_once(g_createdExcutor, [this] {
+        //an Options call either lands before the excutors read them or sees them published
+        std::lock_guard<std::mutex> lock(optionsMutex);
+        const RouterOptions& current = *options;
+        curl_global_init(CURL_GLOBAL_ALL);
+        share = new ShareCache(current.shareConnections);
+        callbacks = current.callbackExecutor;
+        if (callbacks == nullptr && current.callbackThreads > 0) {
+            callbacks = new CallbackPool(current.callbackThreads);
+        }
+        size_t count = std::max<size_t>(1, current.excutorThreads);
+        std::vector<Excutor*>* built = new std::vector<Excutor*>();
+        built->reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            built->push_back(new Excutor(*built, *share, *admission, callbacks, current));
+        }
+        for (Excutor* excutor : *built) {
+            excutor->Start();
+        }
+        excutors = built;
+    });
+}
+
+long long Router::Submit(Task&& task, bool block) {
+    Start();
+    std::shared_ptr<const RouterOptions> current = Current();
+    const RouterOptions& options = *current;
+    Task* submitted = new Task(std::move(task));
+    long long mark = submitted->Mark();
+    //a streamed body is never collected, so there is nothing to keep or share
+    bool shareable = submitted->Type() == Request::TYPE::GET && !submitted->Options().stream;
+    bool cached = (options.cacheBytes > 0 || !options.diskCachePath.empty()) && shareable;
+    if (cached && cache->Serve(*submitted)) {
+        Deliver(submitted);
+        return mark;
     }
-    void Pop(long long mark) {
-        taskQueue.remove_if([mark](const Task & task) {
-            return mark == task.Mark();
-        });
+    bool coalesce = options.coalesceGets && shareable;
+    if (coalesce && coalescer->Join(*submitted, false)) {
+        delete submitted;
+        return mark;
     }
-private:
-    std::list<Task> taskQueue;
-};
-TaskQueue g_taskQueue;
-/*atomic variable determines TaskExcuter Thread Living Status*/
-
-static size_t WriteMemoryCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-    size_t realsize = size * nmemb;
-    Task* task = (Task*)userp;
-    // dltotal == 0则未获取总大小，>0则已获得为realloc，<0 则已realloc
-    if (task->Dltotal() > 0) {
-        task->MemoryAddr((char*)realloc(task->MemoryAddr(), task->Dltotal() + 1));
-        task->Dltotal(-1);
-    } else if (task->Dltotal() == 0) {
-        task->MemoryAddr((char*)realloc(task->MemoryAddr(), task->Size() + realsize + 1));
+    if (!Admit(*submitted, block, options)) {
+        admission->Rejected();
+        delete submitted;
+        return -1;
     }
-    memcpy(&(task->MemoryAddr()[task->Size()]), contents, realsize);
-    task->Size(task->Size() + realsize);
-    //task->MemoryAddr()[task->Size()] = 0;
-    return realsize;
-}
-
-static int xferinfo(void* p, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
-    double curtime = 0;
-    Task* task = (Task*)p;
-    curl_easy_getinfo(task->Curl(), CURLINFO_TOTAL_TIME, &curtime);
-    if (task->Dltotal() == 0 && dltotal != 0) {
-        task->Dltotal(dltotal);
+    //an identical request may have become a transfer while this one waited for room
+    if (coalesce && coalescer->Join(*submitted, true)) {
+        admission->Leave(Admission::Footprint(*submitted));
+        delete submitted;
+        return mark;
     }
-    if (curtime - task->Action()->LastTime() >= task->Action()->ProgressInterval()) {
-        task->Action()->LastTime(curtime);
-        return task->Action()->Progress(curtime, (double)dltotal, (double)dlnow, ultotal, ulnow, *task);
-
+    if (cached) {
+        cache->Fill(*submitted);
+    }
+    const std::vector<Excutor*>& started = Excutors();
+    Excutor* excutor = started[nextExcutor++ % started.size()];
+    while (!excutor->Submit(submitted)) {
+        //ring is full, let the excutor drain it
+        excutor->Wake();
+        std::this_thread::yield();
     }
-    return 0;
+    excutor->Wake();
+    return mark;
 }
 
-static int older_progress(void* p, double dltotal, double dlnow, double ultotal, double ulnow) {
-    return xferinfo(p, (curl_off_t)dltotal, (curl_off_t)dlnow, (curl_off_t)ultotal, (curl_off_t)ulnow);
+void Router::Deliver(Task* task) {
+    if (callbacks == nullptr) {
+        task->Action()->Do(*task);
+        delete task;
+        return;
+    }
+    callbacks->Post([task] {
+        task->Action()->Do(*task);
+        delete task;
+    });
+}
+
+/*hand tasks to excutor in as few reservations of its ring as fit*/
+static void Push(Excutor& excutor, const std::vector<Task*>& tasks) {
+    size_t chunk = excutor.SubmissionCapacity();
+    for (size_t begin = 0; begin < tasks.size();) {
+        size_t count = std::min(chunk, tasks.size() - begin);
+        while (!excutor.Submit(&tasks[begin], count)) {
+            //ring is full, let the excutor drain it
+            excutor.Wake();
+            std::this_thread::yield();
+        }
+        begin += count;
+    }
 }
 
-
-static void init(CURLM* cm) {
-    CURL* eh = curl_easy_init();
-    Task& unhandledTask = *g_taskQueue.FrontUnhandledTask();
-    unhandledTask.Curl(eh);
-    //check request type
-    Request::TYPE type = unhandledTask.Type();
-    if (unhandledTask.Type() == Request::TYPE::POST) {
-        struct curl_httppost* formpost = NULL;
-        struct curl_httppost* lastptr = NULL;
-
-        struct curl_slist* headerlist = NULL;
-        static const char buf[] = "Expect:";
-
-        const std::vector<UploadedData>& uploadedDatas = unhandledTask.Uploadeddatas();
-        for (auto data : uploadedDatas) {
-            CURLformoption opt;
-            if (data.Field() == UploadedData::FIELD::FILE) {
-                opt = CURLformoption::CURLFORM_FILE;
-            } else {
-                opt = CURLformoption::CURLFORM_COPYCONTENTS;
+std::future<std::vector<Response> > Router::GetAll(const std::vector<URL>& urls, size_t needed /*= 0*/, const RequestOptions& options /*= RequestOptions()*/) {
+    if (urls.empty()) {
+        std::promise<std::vector<Response> > none;
+        none.set_value(std::vector<Response>());
+        return none.get_future();
+    }
+    Start();
+    std::shared_ptr<const RouterOptions> current = Current();
+    Batch* batch = new Batch(urls.size(), needed == 0 ? urls.size() : std::min(needed, urls.size()));
+    std::future<std::vector<Response> > result = batch->Result();
+    std::vector<Task*> tasks;
+    tasks.reserve(urls.size());
+    for (auto const& url : urls) {
+        Task* task = new Task(url, batch);
+        task->Options(options);
+        batch->Add(task->Mark());
+        tasks.push_back(task);
+    }
+    //the whole batch goes to one excutor, idle peers steal from it
+    const std::vector<Excutor*>& started = Excutors();
+    Excutor* excutor = started[nextExcutor++ % started.size()];
+    std::vector<Task*> accepted;
+    accepted.reserve(tasks.size());
+    std::vector<long long> unfinished;
+    for (Task* task : tasks) {
+        bool admitted = Admit(*task, false, *current);
+        if (!admitted && current->backpressure == RouterOptions::BLOCK) {
+            //room only comes back as submitted tasks are dispatched
+            Push(*excutor, accepted);
+            accepted.clear();
+            admitted = Admit(*task, true, *current);
+        }
+        if (admitted) {
+            accepted.push_back(task);
+        } else {
+            admission->Rejected();
+            long long mark = task->Mark();
+            delete task;
+            batch->Refused(mark, unfinished);
+        }
+    }
+    Push(*excutor, accepted);
+    excutor->Wake();
+    //a refusal fulfilled the batch, the rest is not waited for
+    for (long long mark : unfinished) {
+        Cancel(mark);
+    }
+    return result;
+}
+
+bool Router::Admit(Task& task, bool block, const RouterOptions& options) {
+    size_t size = Admission::Footprint(task);
+    size_t maxTasks = options.maxQueuedTasks;
+    size_t maxBytes = options.maxQueuedBytes;
+    while (!admission->TryEnter(size, maxTasks, maxBytes)) {
+        if (options.backpressure == RouterOptions::SHED) {
+            //another submitter may take the freed room first, then shed again
+            if (!Shed(TaskQueue::Priority(&task))) {
+                return false;
             }
-            if (data.FileName().empty()) {
-                curl_formadd(&formpost, &lastptr,
-                             CURLFORM_COPYNAME, data.Key().c_str(),
-                             opt, data.Value().c_str(),
-                             CURLFORM_END);
-            } else {
-                curl_formadd(&formpost, &lastptr,
-                             CURLFORM_COPYNAME, data.Key().c_str(),
-                             opt, data.Value().c_str(), CURLFORM_FILENAME, data.FileName().c_str(),
-                             CURLFORM_END);
+        } else if (options.backpressure == RouterOptions::BLOCK && block) {
+            admission->Enter(size, maxTasks, maxBytes);
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Router::Shed(int priority) {
+    Excutor* victim = nullptr;
+    int victimPriority = -1;
+    Clock::time_point oldest;
+    for (Excutor* excutor : Excutors()) {
+        int candidatePriority;
+        Clock::time_point queuedAt;
+        if (excutor->Sheddable(priority, candidatePriority, queuedAt)
+                && (candidatePriority > victimPriority || (candidatePriority == victimPriority && queuedAt < oldest))) {
+            victim = excutor;
+            victimPriority = candidatePriority;
+            oldest = queuedAt;
+        }
+    }
+    if (victim == nullptr) {
+        return false;
+    }
+    //the victim may have dispatched or lost it to a peer meanwhile, the caller retries
+    victim->Shed(victimPriority);
+    return true;
+}
+
+void Router::Cancel(long long mark) {
+    std::vector<long long> parts;
+    if (segmenter->Cancel(mark, parts)) {
+        //the probe or every range of a segmented download
+        for (long long part : parts) {
+            for (Excutor* excutor : Excutors()) {
+                excutor->Cancel(part);
             }
         }
-        headerlist = curl_slist_append(headerlist, buf);
-        curl_easy_setopt(eh, CURLOPT_HTTPHEADER, headerlist);
-        curl_easy_setopt(eh, CURLOPT_HTTPPOST, formpost);
+        return;
     }
-    //set easy handle option
-    curl_easy_setopt(eh, CURLOPT_PRIVATE, (void*)&unhandledTask);
-    curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-    curl_easy_setopt(eh, CURLOPT_WRITEDATA, (void*)&unhandledTask);
-    curl_easy_setopt(eh, CURLOPT_VERBOSE, 0L);
-    curl_easy_setopt(eh, CURLOPT_NOPROGRESS, 0);
-    #if LIBCURL_VERSION_NUM >= 0x072000
-    curl_easy_setopt(eh, CURLOPT_XFERINFOFUNCTION, xferinfo);
-    curl_easy_setopt(eh, CURLOPT_XFERINFODATA, &unhandledTask);
-    #else
-    curl_easy_setopt(eh, CURLOPT_PROGRESSFUNCTION, older_progress);
-    curl_easy_setopt(eh, CURLOPT_PROGRESSDATA, &unhandledTask);
-    #endif
-
-    curl_easy_setopt(eh, CURLOPT_HEADER, 0L);
-    unhandledTask.Url().Escape(eh);
-    curl_easy_setopt(eh, CURLOPT_URL, unhandledTask.Url().ToString().c_str());
-    unhandledTask.Unhandled(false);
-    curl_multi_add_handle(cm, eh);
-}
-
-void Excutor() {
-
-    CURLM* cm = nullptr;
-    CURLMsg* msg;
-    long L;
-    int M, Q, U = -1;
-    fd_set R, W, E;
-    struct timeval T;
-    CURLMcode code;
-    cm = curl_multi_init();
-    int MAX_SIZE = 9;
-    /* we can optionally limit the total amount of connections this multi handle uses */
-    curl_multi_setopt(cm, CURLMOPT_MAXCONNECTS, MAX_SIZE);
-
-    while (true) {
-        while (!g_taskQueue.HasUnhandledTask()) {
-            Sleep(100);
+    long long shared = -1;
+    Task* cancelled = nullptr;
+    if (coalescer->Cancel(mark, shared, cancelled)) {
+        if (cancelled) {
+            //the subscriber does not wait for the shared transfer
+            Deliver(cancelled);
         }
-
-
-        M = Q = U = -1;
-
-        int initNum = 0;
-        while (g_taskQueue.HasUnhandledTask() && initNum++ < MAX_SIZE) {
-            init(cm);
+        if (shared < 0) {
+            //others still wait for the transfer
+            return;
         }
-        while (U) {
-            //when running_handles is set to zero (0) on the return of this function, there is no longer any transfers in progress
-            curl_multi_perform(cm, &U);
-            //when U==0, all in finished
-            if (U) {
-                FD_ZERO(&R);
-                FD_ZERO(&W);
-                FD_ZERO(&E);
-                if (code = curl_multi_fdset(cm, &R, &W, &E, &M)) {
-                    fprintf(stderr, "%s/n", curl_multi_strerror(code));
-                    return;
-                }
-                //An application using the libcurl multi interface should call curl_multi_timeout to figure out how long it should wait for socket actions - at most - before proceeding
-                if (code = curl_multi_timeout(cm, &L)) {
-                    fprintf(stderr, "%s/n", curl_multi_strerror(code));
-                    return;
-                }
-                //optimum solution for next time timeout
-                if (L == -1)
-                    L = 100;
-                if (M == -1) {
-                    Sleep(L);
-                } else {
-                    T.tv_sec = L / 1000;
-                    T.tv_usec = (L % 1000) * 1000;
-                    //The select() system call examines the I/O descriptor sets whose addresses are passed	in readfds, writefds, and exceptfds to see if some of their
-                    //	descriptors are ready for reading, are ready for writing, or have an exceptional condition pending, respectively
-                    if (0 > select(M + 1, &R, &W, &E, &T)) {
-                        fprintf(stderr, "E: select(%i,,,,%li): %i: %s\n",
-                                M + 1, L, errno, strerror(errno));
-                        return;
-                    }
-                }
-            }
+        mark = shared;
+    }
+    //the task may be stolen between excutors at any time, each one looks for it
+    for (Excutor* excutor : Excutors()) {
+        excutor->Cancel(mark);
+    }
+}
 
-            while ((msg = curl_multi_info_read(cm, &Q))) {
-                Task* task;
-                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &task);
-                task->CurlCode(msg->data.result);
+void Router::Resume(long long mark) {
+    for (Excutor* excutor : Excutors()) {
+        excutor->Resume(mark);
+    }
+}
 
-                CURL* e = msg->easy_handle;
-                curl_multi_remove_handle(cm, e);
-                curl_easy_cleanup(e);
+RouterOptions Router::Options() const {
+    return *Current();
+}
 
-                /*Execute action indicate by user*/
-                task->Action()->Do(*task);
-                g_taskQueue.Pop(task->Mark());
-            }
-            if (g_taskQueue.HasUnhandledTask()) {
-                init(cm);
-                U++; /* just to prevent it from remaining at 0 if there are more URLs to get */
-            }
-        }
+void Router::Options(const RouterOptions& val) {
+    //setters apply in the order they publish
+    std::lock_guard<std::mutex> lock(optionsMutex);
+    std::atomic_store(&options, std::shared_ptr<const RouterOptions>(std::make_shared<RouterOptions>(val)));
+    for (Excutor* excutor : Excutors()) {
+        excutor->Configure(val);
     }
+    //raised queue limits let blocked submitters in
+    admission->Notify();
+    cache->Capacity(val.cacheBytes);
+    cache->Disk(val.diskCachePath, val.diskCacheBytes);
 }
 
+std::shared_ptr<const RouterOptions> Router::Current() const {
+    return std::atomic_load(&options);
+}
 
+//before Start, at namespace scope as VS2013 does not guard local statics
+static const std::vector<Excutor*> noExcutors;
 
-void Router::Get(const URL& url, Action* httpAction, Base* userData /*= nullptr*/) {
-    Run(Task(url, httpAction, userData));
+const std::vector<Excutor*>& Router::Excutors() const {
+    std::vector<Excutor*>* started = excutors;
+    return started ? *started : noExcutors;
 }
 
-void Router::Post(const URL& url, const std::vector<UploadedData>& uploadedDatas, Action* httpAction, Base* userData /*= nullptr*/) {
-    Run(Task(url, uploadedDatas, httpAction, userData));
+RouterStats Router::Stats() const {
+    RouterStats stats;
+    for (Excutor* excutor : Excutors()) {
+        stats.easyHandlesCreated += excutor->EasyHandles().Created();
+        stats.easyHandlesReused += excutor->EasyHandles().Reused();
+        excutor->Tasks().Stats(stats);
+        excutor->Stats(stats);
+    }
+    admission->Stats(stats);
+    coalescer->Stats(stats);
+    cache->Stats(stats);
+    return stats;
 }
 
-void Router::Run(Task&& task) {
-    g_taskQueue.Push(std::move(task));
-    if (g_createdExcutor == true) {
-        g_createdExcutor = false;
-        std::thread excutor(Excutor);
-        excutor.detach();
-    }
+Router::Router() : options(std::make_shared<RouterOptions>()), excutors(nullptr), nextExcutor(0), share(nullptr),
+    admission(new Admission()), coalescer(new Coalescer(*this)), cache(new ResponseCache()),
+    segmenter(new Segmenter(*this)), callbacks(nullptr) {
 }
 
 Router::~Router() {
+    //detached excutors may still run while the process exits
 }
 
 UploadedData::UploadedData(FIELD dataType, const std::string& key, const std::string& value, const std::string& filename) : field(dataType), key(key), value(value), fileName(filename) {
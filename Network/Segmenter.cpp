@@ -0,0 +1,288 @@
+﻿#include "stdafx.h"
+#include <cstdlib>
+#include <algorithm>
+#include "Segmenter.h"
+
+namespace Http {
+
+long long Segmenter::Download(const URL& url, const std::shared_ptr<FileSink>& sink, Action* action, Base* userData,
+                              const RequestOptions& options) {
+    Job* job = new Job(*this, url, sink, action, options);
+    Task probe(url, job, userData);
+    RequestOptions probing = options;
+    probing.stream = true;
+    //Content-Range and the validators for If-Range
+    probing.keepHeaders = true;
+    probe.Options(probing);
+    probe.Headers().push_back("Range: bytes=0-0");
+    long long mark = probe.Mark();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job->mark = mark;
+        job->marks.push_back(mark);
+        jobs[mark] = job;
+    }
+    if (router.Run(std::move(probe)) < 0) {
+        //refused, Do never runs
+        Unlist(*job);
+        delete job;
+        return -1;
+    }
+    return mark;
+}
+
+bool Segmenter::Cancel(long long mark, std::vector<long long>& marks) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(mark);
+    if (it == jobs.end()) {
+        return false;
+    }
+    it->second->cancelled = true;
+    marks = it->second->marks;
+    return true;
+}
+
+void Segmenter::Unlist(const Job& job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.erase(job.mark);
+}
+
+Segmenter::Job::Job(Segmenter& owner, const URL& url, const std::shared_ptr<FileSink>& sink, Action* action, const RequestOptions& options)
+    : owner(owner), url(url), sink(sink), action(action), options(options), mark(-1), userData(nullptr), single(nullptr), probing(true),
+      remaining(0), cancelled(false), failed(false), unfinished(false), status(Response::DONE), code(CURLE_OK), responseCode(0),
+      downloaded(0), length(-1), reportedAt(0), started(std::chrono::steady_clock::now()) {
+    this->options.stream = true;
+}
+
+int Segmenter::Job::OnData(const char* data, size_t size, const Task& task) {
+    //only the probe streams into the job, ranges go to their FileWriter
+    if (single) {
+        return single->OnData(data, size, task);
+    }
+    long probed = 0;
+    curl_easy_getinfo(task.Curl(), CURLINFO_RESPONSE_CODE, &probed);
+    if (probed / 100 == 2 && probed != 206) {
+        //the range was ignored, the probe is the whole download
+        single = new FileWriter(sink, 0, action);
+        return single->OnData(data, size, task);
+    }
+    //the probed byte or an error body
+    return CONTINUE;
+}
+
+void Segmenter::Job::Do(const Task& task) {
+    Task& response = const_cast<Task&>(task);
+    if (!probing) {
+        bool ok = response.Status() == Response::DONE && response.CurlCode() == CURLE_OK && response.ResponseCode() / 100 == 2;
+        if (Complete(response, ok)) {
+            Finish(response);
+        }
+        return;
+    }
+    probing = false;
+    long probed = response.ResponseCode();
+    bool done = response.Status() == Response::DONE && response.CurlCode() == CURLE_OK;
+    if (done && single == nullptr && probed / 100 == 2 && probed != 206) {
+        //an empty body still makes a file
+        single = new FileWriter(sink, 0, action);
+    }
+    if (single) {
+        owner.Unlist(*this);
+        FileWriter* writer = single;
+        response.Action(writer);
+        delete this;
+        writer->Do(response);
+        return;
+    }
+    //416: no byte to probe, an empty body
+    if (!done || (probed != 206 && probed != 416)) {
+        //failed, the caller gets the probe as is
+        owner.Unlist(*this);
+        Action* target = action;
+        response.Action(target);
+        delete this;
+        target->Do(response);
+        return;
+    }
+    //the download ends with whichever task is last, it gets the UserData then
+    userData = response.UserData();
+    response.UserData(nullptr);
+    long long total = -1;
+    std::string range = response.Header("Content-Range");
+    size_t slash = range.find('/');
+    if (probed == 206 && slash != std::string::npos && range.compare(slash + 1, 1, "*") != 0) {
+        total = atoll(range.c_str() + slash + 1);
+    }
+    Split(response, total);
+    //the probe did its part, a 416 included
+    if (Complete(response, true)) {
+        Finish(response);
+    }
+}
+
+void Segmenter::Job::Split(const Task& probe, long long total) {
+    const DownloadOptions& download = sink->Options();
+    size_t count = 1;
+    unsigned long long size = 0;
+    if (total > 0) {
+        unsigned long long minimum = std::max<unsigned long long>(1, download.minSegmentBytes);
+        count = (size_t)std::max<unsigned long long>(1, std::min<unsigned long long>(std::max<size_t>(1, download.segments),
+                (total + minimum - 1) / minimum));
+        //range boundaries stay aligned for DownloadOptions::direct
+        size = ((total + count - 1) / count + FileSink::ALIGNMENT - 1) / FileSink::ALIGNMENT * FileSink::ALIGNMENT;
+        count = (size_t)((total + size - 1) / size);
+    }
+    //a range not matching the probed entity would come back as 200 and fail
+    std::string validator = probe.Header("ETag");
+    if (validator.empty() || validator.compare(0, 2, "W/") == 0) {
+        validator = probe.Header("Last-Modified");
+    }
+    //the job holds the file open until every range is submitted
+    sink->Attach();
+    if (total > 0 && download.preallocate) {
+        sink->Reserve(total);
+    }
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        //the probe counts as one
+        remaining = count + 1;
+        marks.clear();
+        length = total;
+    }
+    bool refused = false;
+    for (size_t i = 0; i < count; ++i) {
+        unsigned long long begin = i * size;
+        long long submitted = -1;
+        if (!refused) {
+            FileWriter* writer = new FileWriter(sink, begin, this, total > 0);
+            Task segment(url, writer);
+            segment.Options(options);
+            if (total > 0) {
+                unsigned long long end = std::min<unsigned long long>(begin + size, total) - 1;
+                segment.Headers().push_back("Range: bytes=" + std::to_string(begin) + "-" + std::to_string(end));
+                if (!validator.empty()) {
+                    segment.Headers().push_back("If-Range: " + validator);
+                }
+            }
+            //never block, this may run on an excutor thread
+            submitted = owner.router.TryRun(std::move(segment));
+            if (submitted < 0) {
+                sink->Detach(false, 0);
+                delete writer;
+                refused = true;
+            }
+        }
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        if (submitted < 0) {
+            Fail(Response::DROPPED, CURLE_ABORTED_BY_CALLBACK, 0);
+            --remaining;
+        } else {
+            marks.push_back(submitted);
+        }
+    }
+    std::vector<long long> cancelling;
+    bool finished = sink->Detach(!refused, 0);
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        //a range failing first makes this false too, its own Complete tells why
+        unfinished = !finished;
+        //cancelled meanwhile, or a range failed before its siblings were listed
+        if (cancelled || failed) {
+            cancelling = marks;
+        }
+    }
+    for (long long part : cancelling) {
+        owner.router.Cancel(part);
+    }
+}
+
+void Segmenter::Job::Fail(Response::STATUS status, CURLcode code, long responseCode) {
+    if (failed) {
+        return;
+    }
+    failed = true;
+    this->status = status;
+    this->code = code;
+    this->responseCode = responseCode;
+}
+
+bool Segmenter::Job::Complete(const Task& task, bool ok) {
+    std::vector<long long> cancelling;
+    bool last = false;
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        if (!ok && !failed) {
+            Fail(task.Status(), task.CurlCode(), task.ResponseCode());
+            cancelling = marks;
+        }
+        last = --remaining == 0;
+    }
+    //the siblings report CANCELLED, the first failure is what the caller sees
+    for (long long part : cancelling) {
+        if (part != task.Mark()) {
+            owner.router.Cancel(part);
+        }
+    }
+    return last;
+}
+
+void Segmenter::Job::Finish(Task& task) {
+    owner.Unlist(*this);
+    if (unfinished) {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        Fail(Response::DONE, CURLE_WRITE_ERROR, 0);
+    }
+    if (failed) {
+        task.Status(status);
+        task.CurlCode(code);
+        task.ResponseCode(responseCode);
+    } else {
+        task.ResponseCode(200);
+    }
+    task.UserData(userData);
+    task.Mark(mark);
+    Action* target = action;
+    task.Action(target);
+    delete this;
+    target->Do(task);
+}
+
+int Segmenter::Job::Progress(double, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) {
+    //ticks come from the excutors of every range, the caller sees one download
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double now = 0;
+    double whole = 0;
+    Base* data = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(owner.mutex);
+        double& seen = received[task.Mark()];
+        downloaded += dlnow - seen;
+        seen = dlnow;
+        if (elapsed - reportedAt < action->ProgressInterval()) {
+            return 0;
+        }
+        reportedAt = elapsed;
+        now = downloaded;
+        //the probe alone is the download when its range was ignored
+        whole = length > 0 ? (double)length : (single ? dltotal : 0);
+        data = userData;
+    }
+    std::unique_lock<std::mutex> report(reporting, std::try_to_lock);
+    if (!report.owns_lock()) {
+        return 0;
+    }
+    //called on the excutor thread owning the task, nothing else touches it meanwhile
+    Task& reported = const_cast<Task&>(task);
+    long long own = reported.Mark();
+    Base* ownData = reported.UserData();
+    reported.Mark(mark);
+    if (data) {
+        reported.UserData(data);
+    }
+    int result = action->Progress(elapsed, whole, now, ultotal, ulnow, reported);
+    reported.Mark(own);
+    reported.UserData(ownData);
+    return result;
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "Network/Router.h"
+#include "FileSink.h"
+
+namespace Http {
+/*Segmenter runs the downloads split by DownloadOptions::segments. A probe task asks for
+  the first byte, its Content-Range gives the length, then every range becomes a task
+  writing at its offset of the shared FileSink, spread over the excutors like any other.
+  The caller's Action runs once, for whichever task ends last. The probe's mark names
+  the download.*/
+class Segmenter {
+public:
+    Segmenter(Router& router) : router(router) {}
+    Segmenter(const Segmenter&) = delete;
+    Segmenter& operator=(const Segmenter&) = delete;
+    //any thread: submit the probe, its mark or -1 if refused
+    long long Download(const URL& url, const std::shared_ptr<FileSink>& sink, Action* action, Base* userData,
+                       const RequestOptions& options);
+    //any thread: false if mark is no segmented download, else the marks of its tasks to cancel
+    bool Cancel(long long mark, std::vector<long long>& marks);
+private:
+    /*the Action of the probe and the target of every range's FileWriter, frees itself
+      after the caller's Do*/
+    class Job : public Action {
+    public:
+        Job(Segmenter& owner, const URL& url, const std::shared_ptr<FileSink>& sink, Action* action, const RequestOptions& options);
+        virtual void Do(const Task& task) override;
+        virtual int Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Task& task) override;
+        virtual int OnData(const char* data, size_t size, const Task& task) override;
+        //every tick of every task reaches Progress, the download is throttled there as a whole
+        virtual double ProgressInterval() const override { return 0; }
+        virtual float LastTime() const override { return 0; }
+        virtual void LastTime(float) override {}
+    private:
+        friend class Segmenter;
+        //submit the ranges of a body of total bytes, one unranged task if unknown
+        void Split(const Task& probe, long long total);
+        //a task of the job ended as ok tells, true if it was the last. The first failure cancels the others
+        bool Complete(const Task& task, bool ok);
+        //record a failure, called with the owner's mutex held
+        void Fail(Response::STATUS status, CURLcode code, long responseCode);
+        //hand task to the caller's Action as the outcome of the download and free the job
+        void Finish(Task& task);
+        Segmenter& owner;
+        URL url;
+        std::shared_ptr<FileSink> sink;
+        Action* action;
+        RequestOptions options;
+        long long mark;
+        Base* userData;
+        //the probe got the whole body, the download is this transfer
+        FileWriter* single;
+        bool probing;
+        //guarded by the owner's mutex
+        std::vector<long long> marks;
+        size_t remaining;
+        bool cancelled;
+        bool failed;
+        //the file was not kept, reported unless a task failed for a reason of its own
+        bool unfinished;
+        Response::STATUS status;
+        CURLcode code;
+        long responseCode;
+        //bytes received by each task and in all, the length once known
+        std::unordered_map<long long, double> received;
+        double downloaded;
+        long long length;
+        double reportedAt;
+        std::chrono::steady_clock::time_point started;
+        //one report at a time, the caller's Progress is never entered twice
+        std::mutex reporting;
+    };
+    void Unlist(const Job& job);
+private:
+    Router& router;
+    std::mutex mutex;
+    std::unordered_map<long long, Job*> jobs;
+};
+
+}
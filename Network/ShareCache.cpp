@@ -0,0 +1,42 @@
+﻿#include "stdafx.h"
+#include "ShareCache.h"
+
+namespace Http {
+
+ShareCache::ShareCache(bool shareConnections) : share(curl_share_init()) {
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, Lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, Unlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    if (shareConnections) {
+        //libcurl older than 7.57 answers CURLSHE_BAD_OPTION, every multi handle then keeps its own cache
+        if (curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK) {
+            fprintf(stderr, "W: libcurl can not share connections\n");
+        }
+    }
+}
+
+ShareCache::~ShareCache() {
+    curl_share_cleanup(share);
+}
+
+void ShareCache::Attach(CURL* eh) const {
+    curl_easy_setopt(eh, CURLOPT_SHARE, share);
+}
+
+void ShareCache::Lock(CURL*, curl_lock_data data, curl_lock_access, void* userp) {
+    ShareCache* cache = (ShareCache*)userp;
+    if (data < CURL_LOCK_DATA_LAST) {
+        cache->locks[data].lock();
+    }
+}
+
+void ShareCache::Unlock(CURL*, curl_lock_data data, void* userp) {
+    ShareCache* cache = (ShareCache*)userp;
+    if (data < CURL_LOCK_DATA_LAST) {
+        cache->locks[data].unlock();
+    }
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <mutex>
+#include "Network/curl/curl.h"
+
+namespace Http {
+/*ShareCache is the Router owned curl_share object: DNS, TLS sessions and
+  optionally connections are shared by every easy handle of every excutor*/
+class ShareCache {
+public:
+    explicit ShareCache(bool shareConnections);
+    ~ShareCache();
+    ShareCache(const ShareCache&) = delete;
+    ShareCache& operator=(const ShareCache&) = delete;
+    //attach to an easy handle, again after every curl_easy_reset
+    void Attach(CURL* eh) const;
+private:
+    static void Lock(CURL* eh, curl_lock_data data, curl_lock_access access, void* userp);
+    static void Unlock(CURL* eh, curl_lock_data data, void* userp);
+private:
+    CURLSH* share;
+    //one lock per shared data kind, libcurl never nests them
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+};
+
+}
@@ -0,0 +1,268 @@
+﻿#include "stdafx.h"
+#include <algorithm>
+#include "TaskQueue.h"
+
+namespace Http {
+
+TaskQueue::TaskQueue() : agingMs(500), defaultLimit(), hostLimits(), shards(1),
+    nextReady(Clock::time_point::max()) {
+    inFlight.reserve(64);
+    for (int i = 0; i < RequestOptions::PRIORITY_COUNT; ++i) {
+        dispatched[i] = 0;
+        queueWaitUs[i] = 0;
+        maxQueueWaitUs[i] = 0;
+    }
+}
+
+TaskQueue::~TaskQueue() {
+    for (auto const& queue : pending) {
+        for (auto const& host : queue.hosts) {
+            for (auto const& waiting : host.second.tasks) {
+                delete waiting.task;
+            }
+        }
+    }
+    for (auto const& flying : inFlight) {
+        delete flying.second;
+    }
+}
+
+bool TaskQueue::HasUnhandledTask() const {
+    return !locations.empty();
+}
+
+void TaskQueue::Push(Task* task, Clock::time_point now) {
+    int priority = Priority(task);
+    PriorityQueue& queue = pending[priority];
+    std::string host = task->Url().Host();
+    HostQueue& hostQueue = queue.hosts[host];
+    if (hostQueue.tasks.empty()) {
+        hostQueue.host = host;
+        hostQueue.turn = queue.turns.insert(queue.turns.end(), &hostQueue);
+    }
+    Waiting waiting = { task, now };
+    Location location = { priority, &hostQueue, hostQueue.tasks.insert(hostQueue.tasks.end(), waiting) };
+    locations[task->Mark()] = location;
+}
+
+TaskQueue::Waiting TaskQueue::Unlink(Location location) {
+    Waiting waiting = *location.waiting;
+    HostQueue* hostQueue = location.hostQueue;
+    hostQueue->tasks.erase(location.waiting);
+    locations.erase(waiting.task->Mark());
+    if (hostQueue->tasks.empty()) {
+        PriorityQueue& queue = pending[location.priority];
+        queue.turns.erase(hostQueue->turn);
+        std::string host = hostQueue->host;
+        queue.hosts.erase(host);
+    }
+    return waiting;
+}
+
+Task* TaskQueue::FrontUnhandledTask(Clock::time_point now) {
+    nextReady = Clock::time_point::max();
+    bool taken = false;
+    //a lower class whose next host waited past the aging limit goes first
+    int aged = -1;
+    Clock::time_point agedBefore = now - std::chrono::milliseconds(agingMs);
+    for (int i = RequestOptions::NORMAL; i < RequestOptions::PRIORITY_COUNT; ++i) {
+        if (pending[i].turns.empty()) {
+            continue;
+        }
+        Clock::time_point queuedAt = pending[i].turns.front()->tasks.front().queuedAt;
+        if (queuedAt <= agedBefore && (aged == -1 || queuedAt < pending[aged].turns.front()->tasks.front().queuedAt)) {
+            aged = i;
+        }
+    }
+    if (aged != -1) {
+        Waiting waiting = Take(pending[aged], now, taken);
+        if (taken) {
+            return Dispatch(aged, waiting, now);
+        }
+    }
+    for (int i = 0; i < RequestOptions::PRIORITY_COUNT; ++i) {
+        if (i == aged || pending[i].turns.empty()) {
+            continue;
+        }
+        Waiting waiting = Take(pending[i], now, taken);
+        if (taken) {
+            return Dispatch(i, waiting, now);
+        }
+    }
+    return nullptr;
+}
+
+TaskQueue::Waiting TaskQueue::Take(PriorityQueue& queue, Clock::time_point now, bool& taken) {
+    Waiting waiting = { nullptr, now };
+    taken = false;
+    for (size_t turn = queue.turns.size(); turn > 0; --turn) {
+        HostQueue* hostQueue = queue.turns.front();
+        //the host goes to the back of the round either way
+        queue.turns.splice(queue.turns.end(), queue.turns, queue.turns.begin());
+        if (!TakeToken(hostQueue->host, now)) {
+            continue;
+        }
+        waiting = Unlink(locations[hostQueue->tasks.front().task->Mark()]);
+        taken = true;
+        break;
+    }
+    return waiting;
+}
+
+Task* TaskQueue::Dispatch(int priority, const Waiting& waiting, Clock::time_point now) {
+    unsigned long long waitUs = std::chrono::duration_cast<std::chrono::microseconds>(now - waiting.queuedAt).count();
+    ++dispatched[priority];
+    queueWaitUs[priority] += waitUs;
+    if (waitUs > maxQueueWaitUs[priority]) {
+        maxQueueWaitUs[priority] = waitUs;
+    }
+    Task* task = waiting.task;
+    task->Unhandled(false);
+    inFlight[task->Mark()] = task;
+    return task;
+}
+
+Clock::time_point TaskQueue::NextReady() const {
+    return nextReady;
+}
+
+bool TaskQueue::TakeToken(const std::string& host, Clock::time_point now) {
+    if (defaultLimit.requestsPerSecond <= 0 && hostLimits.empty()) {
+        return true;
+    }
+    Bucket& bucket = BucketOf(host, now);
+    if (bucket.rate <= 0) {
+        return true;
+    }
+    double elapsed = std::chrono::duration_cast<std::chrono::duration<double> >(now - bucket.refilled).count();
+    bucket.tokens = std::min(bucket.burst, bucket.tokens + elapsed * bucket.rate);
+    bucket.refilled = now;
+    if (bucket.tokens >= 1) {
+        bucket.tokens -= 1;
+        return true;
+    }
+    Clock::time_point ready = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((1 - bucket.tokens) / bucket.rate));
+    nextReady = std::min(nextReady, ready);
+    return false;
+}
+
+TaskQueue::Bucket& TaskQueue::BucketOf(const std::string& host, Clock::time_point now) {
+    auto it = buckets.find(host);
+    if (it == buckets.end()) {
+        HostRateLimit limit = LimitOf(host);
+        Bucket bucket;
+        bucket.rate = limit.requestsPerSecond / shards;
+        bucket.burst = std::max(1.0, limit.burst / shards);
+        bucket.tokens = bucket.burst;
+        bucket.refilled = now;
+        it = buckets.insert(std::make_pair(host, bucket)).first;
+    }
+    return it->second;
+}
+
+HostRateLimit TaskQueue::LimitOf(const std::string& host) const {
+    auto it = hostLimits.find(host);
+    return it == hostLimits.end() ? defaultLimit : it->second;
+}
+
+Task* TaskQueue::Steal(Clock::time_point& queuedAt) {
+    for (int i = RequestOptions::PRIORITY_COUNT - 1; i >= 0; --i) {
+        PriorityQueue& queue = pending[i];
+        if (queue.turns.empty()) {
+            continue;
+        }
+        HostQueue* hostQueue = queue.turns.back();
+        Waiting waiting = Unlink(locations[hostQueue->tasks.back().task->Mark()]);
+        queuedAt = waiting.queuedAt;
+        return waiting.task;
+    }
+    return nullptr;
+}
+
+bool TaskQueue::IsPending(long long mark) const {
+    return locations.find(mark) != locations.end();
+}
+
+Task* TaskQueue::Remove(long long mark) {
+    auto it = locations.find(mark);
+    if (it == locations.end()) {
+        return nullptr;
+    }
+    return Unlink(it->second).task;
+}
+
+const TaskQueue::HostQueue* TaskQueue::Oldest(int priority) const {
+    const HostQueue* oldest = nullptr;
+    for (const HostQueue* hostQueue : pending[priority].turns) {
+        if (oldest == nullptr || hostQueue->tasks.front().queuedAt < oldest->tasks.front().queuedAt) {
+            oldest = hostQueue;
+        }
+    }
+    return oldest;
+}
+
+bool TaskQueue::Sheddable(int priority, int& victimPriority, Clock::time_point& queuedAt) const {
+    for (int i = RequestOptions::PRIORITY_COUNT - 1; i >= priority; --i) {
+        if (const HostQueue* hostQueue = Oldest(i)) {
+            victimPriority = i;
+            queuedAt = hostQueue->tasks.front().queuedAt;
+            return true;
+        }
+    }
+    return false;
+}
+
+Task* TaskQueue::Shed(int priority) {
+    const HostQueue* hostQueue = Oldest(priority);
+    if (hostQueue == nullptr) {
+        return nullptr;
+    }
+    return Unlink(locations[hostQueue->tasks.front().task->Mark()]).task;
+}
+
+Task* TaskQueue::InFlight(long long mark) const {
+    auto it = inFlight.find(mark);
+    return it == inFlight.end() ? nullptr : it->second;
+}
+
+Task* TaskQueue::Pop(long long mark) {
+    auto it = inFlight.find(mark);
+    if (it == inFlight.end()) {
+        return nullptr;
+    }
+    Task* task = it->second;
+    inFlight.erase(it);
+    return task;
+}
+
+size_t TaskQueue::PendingSize() const {
+    return locations.size();
+}
+
+size_t TaskQueue::InFlightSize() const {
+    return inFlight.size();
+}
+
+void TaskQueue::Configure(const RouterOptions& options, size_t val) {
+    agingMs = options.priorityAgingMs;
+    defaultLimit = options.hostRateLimit;
+    hostLimits = options.hostRateLimits;
+    shards = std::max<size_t>(1, val);
+    //buckets are rebuilt with the new limits when next needed
+    buckets.clear();
+}
+
+void TaskQueue::Stats(RouterStats& stats) const {
+    for (int i = 0; i < RequestOptions::PRIORITY_COUNT; ++i) {
+        stats.dispatched[i] += dispatched[i];
+        stats.queueWaitUs[i] += queueWaitUs[i];
+        stats.maxQueueWaitUs[i] = std::max<unsigned long long>(stats.maxQueueWaitUs[i], maxQueueWaitUs[i]);
+    }
+}
+
+int TaskQueue::Priority(const Task* task) {
+    int priority = task->Options().priority;
+    return priority < 0 || priority >= RequestOptions::PRIORITY_COUNT ? RequestOptions::NORMAL : priority;
+}
+
+}
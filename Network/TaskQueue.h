@@ -0,0 +1,228 @@
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "Network/Router.h"
+
+namespace Http {
+
+typedef std::chrono::steady_clock Clock;
+
+/*taskQueue maintains the tasks of one excutor thread. Pending tasks wait per priority
+  class in per host FIFOs which are served round robin, optionally paced by a token
+  bucket per host. In-flight tasks live in a map indexed by Task::Mark.
+  Dispatch and completion are O(1) in the number of tasks.*/
+class TaskQueue {
+public:
+    TaskQueue();
+    ~TaskQueue();
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    bool HasUnhandledTask() const;
+    //takes ownership of task
+    void Push(Task* task, Clock::time_point now = Clock::now());
+    //move the next pending task to in-flight, nullptr if every waiting host is out of tokens
+    Task* FrontUnhandledTask(Clock::time_point now = Clock::now());
+    //when a rate limited host gets its next token, max() if nothing is held back
+    Clock::time_point NextReady() const;
+    //take the newest pending task of the lowest class, used by stealing peers
+    Task* Steal(Clock::time_point& queuedAt);
+    bool IsPending(long long mark) const;
+    //unlink a pending task, the caller owns it afterwards
+    Task* Remove(long long mark);
+    //the lowest class at or below priority holding tasks and the wait of its oldest one
+    bool Sheddable(int priority, int& victimPriority, Clock::time_point& queuedAt) const;
+    //unlink the oldest pending task of class priority, the caller owns it afterwards
+    Task* Shed(int priority);
+    Task* InFlight(long long mark) const;
+    //forget an in-flight task, the caller owns it afterwards
+    Task* Pop(long long mark);
+    size_t PendingSize() const;
+    size_t InFlightSize() const;
+    //aging and rate limits, rates are split over shards excutors
+    void Configure(const RouterOptions& options, size_t shards);
+    //add the queue wait counters, any thread
+    void Stats(RouterStats& stats) const;
+    //class of task, out of range priorities count as NORMAL
+    static int Priority(const Task* task);
+private:
+    struct Waiting {
+        Task* task;
+        Clock::time_point queuedAt;
+    };
+    struct HostQueue;
+    typedef std::list<HostQueue*> Turns;
+    struct HostQueue {
+        std::string host;
+        std::list<Waiting> tasks;
+        Turns::iterator turn;
+    };
+    /*one priority class: hosts with pending tasks take turns*/
+    struct PriorityQueue {
+        std::unordered_map<std::string, HostQueue> hosts;
+        Turns turns;
+    };
+    /*where a pending task waits, for O(1) removal*/
+    struct Location {
+        int priority;
+        HostQueue* hostQueue;
+        std::list<Waiting>::iterator waiting;
+    };
+    struct Bucket {
+        double tokens;
+        double rate;
+        double burst;
+        Clock::time_point refilled;
+    };
+    //consume a token of host, else remember when the next one is due
+    bool TakeToken(const std::string& host, Clock::time_point now);
+    Bucket& BucketOf(const std::string& host, Clock::time_point now);
+    HostRateLimit LimitOf(const std::string& host) const;
+    Waiting Take(PriorityQueue& queue, Clock::time_point now, bool& taken);
+    Task* Dispatch(int priority, const Waiting& waiting, Clock::time_point now);
+    //unlink the waiting entry at location, dropping its host once empty,
+    //by value as location may be the entry of locations being erased
+    Waiting Unlink(Location location);
+    //host of class priority whose front task waits longest, nullptr if the class is empty
+    const HostQueue* Oldest(int priority) const;
+private:
+    PriorityQueue pending[RequestOptions::PRIORITY_COUNT];
+    std::unordered_map<long long, Location> locations;
+    long long agingMs;
+    HostRateLimit defaultLimit;
+    std::map<std::string, HostRateLimit> hostLimits;
+    size_t shards;
+    std::unordered_map<std::string, Bucket> buckets;
+    Clock::time_point nextReady;
+    std::unordered_map<long long, Task*> inFlight;
+    std::atomic<unsigned long long> dispatched[RequestOptions::PRIORITY_COUNT];
+    std::atomic<unsigned long long> queueWaitUs[RequestOptions::PRIORITY_COUNT];
+    std::atomic<unsigned long long> maxQueueWaitUs[RequestOptions::PRIORITY_COUNT];
+};
+
+/*Bounded lock-free multi-producer/single-consumer queue of submitted tasks.
+  Each cell carries a sequence number telling whether it is free for the producer
+  of that lap or filled for the consumer, so producers only contend on the
+  enqueue cursor and never wait for each other or for the consumer.*/
+class SubmissionQueue {
+public:
+    //capacity is rounded up to a power of two
+    explicit SubmissionQueue(size_t capacity) : cells(RoundUp(capacity)), mask(cells.size() - 1), enqueuePos(0), dequeuePos(0) {
+        for (size_t i = 0; i < cells.size(); ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+            cells[i].task = nullptr;
+        }
+    }
+    SubmissionQueue(const SubmissionQueue&) = delete;
+    SubmissionQueue& operator=(const SubmissionQueue&) = delete;
+
+    //any thread, false if the queue is full
+    bool TryPush(Task* task) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.task = task;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //any thread, all count tasks behind one reservation of the enqueue cursor or none,
+    //false if they do not fit now or at all
+    bool TryPush(Task* const* tasks, size_t count) {
+        if (count == 0) {
+            return true;
+        }
+        if (count > cells.size()) {
+            return false;
+        }
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                //the consumer frees cells in order, if the last one is free so are the others
+                const Cell& last = cells[(pos + count - 1) & mask];
+                if ((intptr_t)last.sequence.load(std::memory_order_acquire) - (intptr_t)(pos + count - 1) < 0) {
+                    return false;
+                }
+                if (enqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                    for (size_t i = 0; i < count; ++i) {
+                        Cell& reserved = cells[(pos + i) & mask];
+                        reserved.task = tasks[i];
+                        reserved.sequence.store(pos + i + 1, std::memory_order_release);
+                    }
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //capacity rounded up
+    size_t Capacity() const {
+        return cells.size();
+    }
+
+    //excutor thread only, nullptr if the queue is empty
+    Task* TryPop() {
+        Cell& cell = cells[dequeuePos & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        if ((intptr_t)sequence - (intptr_t)(dequeuePos + 1) < 0) {
+            return nullptr;
+        }
+        Task* task = cell.task;
+        cell.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+        ++dequeuePos;
+        return task;
+    }
+
+    bool Empty() const {
+        const Cell& cell = cells[dequeuePos & mask];
+        return (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)(dequeuePos + 1) < 0;
+    }
+private:
+    struct Cell {
+        Cell() : sequence(0), task(nullptr) {}
+        Cell(const Cell& cell) : sequence(cell.sequence.load()), task(cell.task) {}
+        std::atomic<size_t> sequence;
+        Task* task;
+    };
+    static size_t RoundUp(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+private:
+    std::vector<Cell> cells;
+    const size_t mask;
+    //keep producer and consumer cursors on different cache lines
+    char pad0[64];
+    std::atomic<size_t> enqueuePos;
+    char pad1[64];
+    size_t dequeuePos;
+    char pad2[64];
+};
+
+}
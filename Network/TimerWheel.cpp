@@ -0,0 +1,143 @@
+﻿#include "stdafx.h"
+#include <algorithm>
+#include "TimerWheel.h"
+
+namespace Http {
+
+TimerWheel::TimerWheel() : origin(Clock::now()), current(0), size(0) {
+    for (int level = 0; level < LEVELS; ++level) {
+        counts[level] = 0;
+        for (int slot = 0; slot < SLOTS; ++slot) {
+            slots[level][slot] = nullptr;
+        }
+    }
+}
+
+unsigned long long TimerWheel::TickOf(Clock::time_point when) const {
+    if (when <= origin) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(when - origin).count();
+}
+
+void TimerWheel::Arm(Timer& timer, Clock::time_point when) {
+    Disarm(timer);
+    //round up, a timer never fires early
+    unsigned long long tick = when == Clock::time_point::max() ? ~0ULL : TickOf(when + std::chrono::microseconds(999));
+    timer.tick = std::max(tick, current + 1);
+    Place(timer);
+    ++size;
+}
+
+void TimerWheel::Disarm(Timer& timer) {
+    if (Armed(timer)) {
+        Unlink(timer);
+        --size;
+    }
+}
+
+bool TimerWheel::Armed(const Timer& timer) {
+    return timer.list != nullptr;
+}
+
+void TimerWheel::Place(Timer& timer) {
+    unsigned long long tick = std::max(timer.tick, current);
+    unsigned long long delta = tick - current;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= 1ULL << (BITS * (level + 1))) {
+        ++level;
+    }
+    if (delta >= 1ULL << (BITS * LEVELS)) {
+        //beyond the top wheel, parked in its farthest slot and re-placed when it cascades
+        tick = current + (1ULL << (BITS * LEVELS)) - 1;
+    }
+    Timer** list = &slots[level][(tick >> (BITS * level)) & (SLOTS - 1)];
+    timer.list = list;
+    timer.prev = nullptr;
+    timer.next = *list;
+    if (*list) {
+        (*list)->prev = &timer;
+    }
+    *list = &timer;
+    ++counts[level];
+}
+
+void TimerWheel::Unlink(Timer& timer) {
+    if (timer.prev) {
+        timer.prev->next = timer.next;
+    } else {
+        *timer.list = timer.next;
+    }
+    if (timer.next) {
+        timer.next->prev = timer.prev;
+    }
+    --counts[(timer.list - &slots[0][0]) / SLOTS];
+    timer.prev = nullptr;
+    timer.next = nullptr;
+    timer.list = nullptr;
+}
+
+void TimerWheel::Cascade(int level) {
+    Timer** list = &slots[level][(current >> (BITS * level)) & (SLOTS - 1)];
+    Timer* timer = *list;
+    while (timer) {
+        Timer* next = timer->next;
+        Unlink(*timer);
+        Place(*timer);
+        timer = next;
+    }
+}
+
+void TimerWheel::Advance(Clock::time_point now, std::vector<Timer*>& fired) {
+    unsigned long long target = TickOf(now);
+    if (size == 0) {
+        current = std::max(current, target);
+        return;
+    }
+    while (current < target) {
+        if (counts[0] == 0) {
+            //nothing due before the next cascade, jump to it
+            current = std::min(target, current | (SLOTS - 1));
+            if (current == target) {
+                break;
+            }
+        }
+        ++current;
+        for (int level = 1; level < LEVELS && (current & ((1ULL << (BITS * level)) - 1)) == 0; ++level) {
+            Cascade(level);
+        }
+        Timer** list = &slots[0][current & (SLOTS - 1)];
+        while (Timer* timer = *list) {
+            Unlink(*timer);
+            --size;
+            fired.push_back(timer);
+        }
+    }
+}
+
+TimerWheel::Clock::time_point TimerWheel::NextExpiry() const {
+    unsigned long long next = ~0ULL;
+    for (int level = 0; level < LEVELS; ++level) {
+        if (counts[level] == 0) {
+            continue;
+        }
+        //the first occupied slot after current comes due at the start of its span
+        unsigned long long span = current >> (BITS * level);
+        for (unsigned long long i = 1; i <= SLOTS; ++i) {
+            if (slots[level][(span + i) & (SLOTS - 1)]) {
+                next = std::min(next, (span + i) << (BITS * level));
+                break;
+            }
+        }
+    }
+    if (next == ~0ULL) {
+        return Clock::time_point::max();
+    }
+    return origin + std::chrono::milliseconds(next);
+}
+
+size_t TimerWheel::Size() const {
+    return size;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <chrono>
+#include <vector>
+
+namespace Http {
+/*Hierarchical timer wheel with millisecond ticks: LEVELS wheels of SLOTS slots,
+  each level SLOTS times coarser than the one below. Timers are intrusive list
+  nodes, so Arm and Disarm are O(1) whatever the number of timers; a timer
+  cascades to a finer level when the coarse slot holding it comes due.
+  Single threaded, owned by one excutor.*/
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock Clock;
+    struct Timer {
+        Timer() : prev(nullptr), next(nullptr), list(nullptr), tick(0), mark(0), kind(0) {}
+        Timer* prev;
+        Timer* next;
+        //slot the timer is linked into, nullptr when not armed
+        Timer** list;
+        unsigned long long tick;
+        //what the timer is for, left to the owner
+        long long mark;
+        int kind;
+    };
+public:
+    TimerWheel();
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    //(re)arm timer to fire at when, past times fire on the next Advance
+    void Arm(Timer& timer, Clock::time_point when);
+    void Disarm(Timer& timer);
+    static bool Armed(const Timer& timer);
+    //move the wheel to now, timers that came due are disarmed and appended to fired
+    void Advance(Clock::time_point now, std::vector<Timer*>& fired);
+    //when Advance has something to do next, a fire or a cascade, max() if no timer is armed
+    Clock::time_point NextExpiry() const;
+    size_t Size() const;
+private:
+    enum : int {
+        BITS = 6,
+        SLOTS = 1 << BITS,
+        LEVELS = 4
+    };
+    unsigned long long TickOf(Clock::time_point when) const;
+    void Place(Timer& timer);
+    void Unlink(Timer& timer);
+    //re-place the timers of the slot of level that comes due at current
+    void Cascade(int level);
+private:
+    Clock::time_point origin;
+    unsigned long long current;
+    size_t size;
+    size_t counts[LEVELS];
+    Timer* slots[LEVELS][SLOTS];
+};
+
+}
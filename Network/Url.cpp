@@ -2,6 +2,8 @@
 #include <sstream>
 #include <random>
 #include <array>
+#include <algorithm>
+#include <cctype>
 #include "Network/URL.h"
 
 namespace Http {
@@ -52,6 +54,36 @@ const URL::AttribMap& URL::GetAttribMap() const {
     return queryString;
 }
 
+std::string URL::Host() const {
+    std::string authority;
+    if (!host.empty()) {
+        authority = host;
+    } else {
+        size_t begin = stringizedUrl.find("://");
+        begin = begin == std::string::npos ? 0 : begin + 3;
+        size_t end = stringizedUrl.find_first_of("/?#", begin);
+        authority = stringizedUrl.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        // 去掉 user:password@
+        size_t at = authority.rfind('@');
+        if (at != std::string::npos) {
+            authority.erase(0, at + 1);
+        }
+    }
+    std::transform(authority.begin(), authority.end(), authority.begin(), ::tolower);
+    return authority;
+}
+
+std::string URL::Canonical() const {
+    if (!stringizedUrl.empty() || host.empty()) {
+        return stringizedUrl;
+    }
+    std::string canonical = scheme + "://" + Host() + path;
+    if (!queryString.empty()) {
+        canonical += "?" + queryString.ToString();
+    }
+    return canonical;
+}
+
 void URL::Escape(CURL* eh) {
     if (stringizedUrl.empty()) {
         stringizedUrl.reserve((host.length() + path.length()) * 5);
@@ -0,0 +1,80 @@
+#pragma once
+#include "Router.h"
+//C++20 only, the library itself builds as C++11 and does not need this header
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 202002L) || __cplusplus >= 202002L) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <optional>
+#include <utility>
+
+namespace Http {
+/*Awaitable request: co_await Http::CoGet(url) suspends the coroutine until the
+  transfer ends and resumes it with the Response. The awaitable is the Action of
+  its own request and lives in the coroutine frame, nothing else is allocated.
+  The coroutine resumes on the thread running Action::Do, an excutor thread or the
+  callback executor of RouterOptions, or is posted to scheduler when one is given.
+  A request refused by a full queue resumes at once with Response::DROPPED.*/
+class Awaitable : public Action {
+public:
+    Awaitable(const URL& url, const RequestOptions& options, CallbackExecutor* scheduler)
+        : url(url), post(false), options(options), scheduler(scheduler) {}
+    Awaitable(const URL& url, const std::vector<UploadedData>& uploadedDatas, const RequestOptions& options, CallbackExecutor* scheduler)
+        : url(url), post(true), uploadedDatas(uploadedDatas), options(options), scheduler(scheduler) {}
+    Awaitable(const Awaitable&) = delete;
+    Awaitable& operator=(const Awaitable&) = delete;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<> coroutine) {
+        handle = coroutine;
+        long long mark = post ? ROUTER.Post(url, uploadedDatas, this, nullptr, options) : ROUTER.Get(url, this, nullptr, options);
+        if (mark >= 0) {
+            //Do may already have resumed the coroutine and freed this, touch nothing
+            return true;
+        }
+        response.emplace();
+        response->Status(Response::DROPPED);
+        response->CurlCode(CURLE_ABORTED_BY_CALLBACK);
+        return false;
+    }
+    Response await_resume() {
+        return std::move(*response);
+    }
+
+    virtual void Do(const Task& task) override {
+        //the task is freed right after Do, its body is taken instead of copied
+        response.emplace(std::move(static_cast<Response&>(const_cast<Task&>(task))));
+        std::coroutine_handle<> coroutine = handle;
+        if (scheduler) {
+            scheduler->Post([coroutine] { coroutine.resume(); });
+        } else {
+            coroutine.resume();
+        }
+    }
+    virtual int Progress(double, double, double, double, double, const Task&) override {
+        return 0;
+    }
+private:
+    URL url;
+    bool post;
+    std::vector<UploadedData> uploadedDatas;
+    RequestOptions options;
+    CallbackExecutor* scheduler;
+    std::coroutine_handle<> handle;
+    std::optional<Response> response;
+};
+
+inline Awaitable CoGet(const URL& url, const RequestOptions& options = RequestOptions(), CallbackExecutor* scheduler = nullptr) {
+    return Awaitable(url, options, scheduler);
+}
+
+inline Awaitable CoPost(const URL& url, const std::vector<UploadedData>& uploadedDatas, const RequestOptions& options = RequestOptions(),
+                        CallbackExecutor* scheduler = nullptr) {
+    return Awaitable(url, uploadedDatas, options, scheduler);
+}
+
+}
+
+#endif
+#endif
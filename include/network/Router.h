@@ -1,6 +1,13 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <future>
+#include <bitset>
+#include <memory>
 #include "curl/curl.h"
 #include "URL.h"
 #ifdef _DEBUG
@@ -22,23 +29,28 @@ public:
     virtual ~Base() {}
 };
 
-class NETWORK_API Memory : public Base {
+class  Memory : public Base {
 public:
-    Memory();
-    Memory(const Memory& memory);
-    Memory(Memory&& memory);
-    Memory& operator=(const Memory& memory) = delete;
-    bool operator==(const Memory&)const;
+    NETWORK_API Memory();
+    NETWORK_API Memory(const Memory& memory);
+    NETWORK_API Memory(Memory&& memory);
+    NETWORK_API Memory& operator=(const Memory& memory) = delete;
+    NETWORK_API bool operator==(const Memory&)const;
     //Setter and getter
 public:
-    char* MemoryAddr() const;
-    void MemoryAddr(char* val);
-    size_t Size() const;
-    void Size(size_t val);
-    virtual ~Memory();
+    NETWORK_API char* MemoryAddr() const;
+    NETWORK_API void MemoryAddr(char* val);
+    NETWORK_API size_t Size() const;
+    NETWORK_API void Size(size_t val);
+    //point at size bytes kept alive by owner instead of an own buffer, e.g. a cached body
+    //or a mapped view of the disk cache shared with other responses: read only, it is not freed here
+    NETWORK_API void Borrow(char* addr, size_t size, const std::shared_ptr<void>& owner);
+    NETWORK_API bool Borrowed() const;
+    NETWORK_API virtual ~Memory();
 private:
     char* memoryAddr;
     size_t size;
+    std::shared_ptr<void> owner;
 };
 
 
@@ -70,6 +82,93 @@ private:
     std::string fileName;
 };
 
+/*when a failed request is tried again and how long it waits before, retries also
+  need a token of RouterOptions::retryBudget*/
+struct RetryPolicy {
+    RetryPolicy(int maxAttempts = 1) : maxAttempts(maxAttempts), baseDelayMs(100), maxDelayMs(10000), retryPost(false) {
+        curlCodes.set(CURLE_COULDNT_RESOLVE_HOST).set(CURLE_COULDNT_CONNECT).set(CURLE_OPERATION_TIMEDOUT)
+        .set(CURLE_SEND_ERROR).set(CURLE_RECV_ERROR).set(CURLE_GOT_NOTHING).set(CURLE_PARTIAL_FILE);
+        httpStatuses.set(408).set(429).set(500).set(502).set(503).set(504);
+    }
+    //tries in all, 1 never retries. -1 in RequestOptions takes the RouterOptions policy
+    int maxAttempts;
+    //the n-th retry waits a random time below baseDelayMs * 2^(n-1), capped at maxDelayMs
+    long long baseDelayMs;
+    long long maxDelayMs;
+    //POST is not idempotent, it is only retried on request
+    bool retryPost;
+    //failures worth another try: CURLcodes and, for completed transfers, HTTP statuses
+    std::bitset<CURL_LAST> curlCodes;
+    std::bitset<600> httpStatuses;
+};
+
+/*GET only: when the first transfer has not finished after the given percentile of the
+  recent latencies of its host, an identical second one is sent. The first to finish
+  is kept and the other aborted; a failed one is dropped while its twin still runs.
+  Hedges need a token of RouterOptions::hedgeBudget and do not take a concurrency slot*/
+struct HedgePolicy {
+    HedgePolicy(double percentile = 0) : percentile(percentile), delayMs(100), minDelayMs(10), maxDelayMs(10000) {}
+    //e.g. 0.95, 0 never hedges. -1 in RequestOptions takes the RouterOptions policy
+    double percentile;
+    //hedge delay until the host has enough samples for a percentile
+    long long delayMs;
+    //bounds of the percentile delay
+    long long minDelayMs;
+    long long maxDelayMs;
+};
+
+/*Per request options*/
+struct RequestOptions {
+    enum PRIORITY : int {
+        HIGH = 0,
+        NORMAL = 1,
+        LOW = 2,
+        PRIORITY_COUNT = 3
+    };
+    RequestOptions(PRIORITY priority = NORMAL) : priority(priority), connectTimeoutMs(-1), timeoutMs(-1), idleTimeoutMs(-1), retry(-1), hedge(-1),
+        keepHeaders(false), stream(false) {}
+    //pending tasks are dispatched by priority class, old enough tasks of any class go first
+    PRIORITY priority;
+    //deadlines in milliseconds, -1 takes the RouterOptions one, 0 is none.
+    //connect: CURLOPT_CONNECTTIMEOUT_MS
+    long long connectTimeoutMs;
+    //total: from the excutor taking the task to its completion, time spent pending included
+    long long timeoutMs;
+    //idle: an in-flight transfer moving no bytes, noticed between once and twice this long
+    long long idleTimeoutMs;
+    //retries run within timeoutMs, a task waiting to retry keeps its concurrency slot
+    RetryPolicy retry;
+    HedgePolicy hedge;
+    //collect the response header block, see Response::Header
+    bool keepHeaders;
+    //hand the body to Action::OnData as it arrives instead of collecting it, Do then gets
+    //an empty body. Such a request is never cached, coalesced or hedged, and not retried
+    //once a byte of the body arrived. A paused transfer moves no bytes, mind idleTimeoutMs
+    bool stream;
+};
+
+/*how Router::Download writes the file*/
+struct DownloadOptions {
+    DownloadOptions() : chunkBytes(1 << 20), preallocate(true), direct(false), writeBehind(false),
+        segments(1), minSegmentBytes(4 << 20) {}
+    //body bytes gathered before a write, rounded up to 4096
+    size_t chunkBytes;
+    //allocate Content-Length bytes on disk before the first write
+    bool preallocate;
+    //bypass the page cache: O_DIRECT, FILE_FLAG_NO_BUFFERING on Windows. Where the file
+    //system refuses it the file is written through the page cache
+    bool direct;
+    //Linux: start writeback of every block and drop the one before from the page cache,
+    //so a large download does not flood it
+    bool writeBehind;
+    //byte ranges fetched in parallel as tasks of their own, each over its own connection.
+    //A probe asks for the first byte to learn the length, a server ignoring ranges gets
+    //a single transfer. Ranges are at least minSegmentBytes, and there is one
+    //completion: the first failure if any, else 200
+    size_t segments;
+    size_t minSegmentBytes;
+};
+
 /*HTTP request*/
 //class TaskQueue;
 class  Request : public Base {
@@ -99,36 +198,67 @@ public:
     NETWORK_API std::vector<UploadedData>& Uploadeddatas();
     NETWORK_API Http::Request::TYPE Type() const;
     NETWORK_API void Type(Http::Request::TYPE val);
+    NETWORK_API const RequestOptions& Options() const;
+    NETWORK_API void Options(const RequestOptions& val);
+    //extra request header lines, "Name: value"
+    NETWORK_API const std::vector<std::string>& Headers() const;
+    NETWORK_API std::vector<std::string>& Headers();
 protected:
     URL url;
     bool unhandled;
     Base* userData;
     std::vector<UploadedData> updDatas;
     TYPE type;
+    RequestOptions options;
+    std::vector<std::string> headers;
 };
 
 
 
 /*HTTP response*/
-class NETWORK_API Response : public Memory {
+class  Response : public Memory {
+public:
+    enum STATUS : int {
+        DONE = 0,
+        //stopped by Router::Cancel, CurlCode is CURLE_ABORTED_BY_CALLBACK
+        CANCELLED = 1,
+        //a deadline of RequestOptions passed, CurlCode is CURLE_OPERATION_TIMEDOUT
+        TIMEDOUT = 2,
+        //shed from a full queue for a more urgent task, CurlCode is CURLE_ABORTED_BY_CALLBACK
+        DROPPED = 3
+    };
 public:
-    Response();
-    Response(const Response& response);
-    Response(Response&& response);
-    Response& operator=(const Response&) = delete;
-    bool operator==(const Response&& response)const;
-    ~Response() {}
-    curl_off_t Dltotal() const;
-    void Dltotal(curl_off_t val);
+    NETWORK_API Response();
+    NETWORK_API Response(const Response& response);
+    NETWORK_API Response(Response&& response);
+    NETWORK_API Response& operator=(const Response&) = delete;
+    NETWORK_API bool operator==(const Response&& response)const;
+    NETWORK_API ~Response() {}
+    NETWORK_API curl_off_t Dltotal() const;
+    NETWORK_API void Dltotal(curl_off_t val);
     //Setter and getter
 public:
-    CURLcode CurlCode() const;
-    void CurlCode(CURLcode val);
-    CURL* Curl() const;
-    void Curl(CURL* val);
+    NETWORK_API CURLcode CurlCode() const;
+    NETWORK_API void CurlCode(CURLcode val);
+    NETWORK_API CURL* Curl() const;
+    NETWORK_API void Curl(CURL* val);
+    NETWORK_API STATUS Status() const;
+    NETWORK_API void Status(STATUS val);
+    //CURLINFO_RESPONSE_CODE, kept as Curl() is null in Do when a callback executor runs it
+    NETWORK_API long ResponseCode() const;
+    NETWORK_API void ResponseCode(long val);
+    //raw header block, collected with RequestOptions::keepHeaders
+    NETWORK_API const std::string& ResponseHeaders() const;
+    NETWORK_API std::string& ResponseHeaders();
+    //value of header name in the last response of the block, case insensitive,
+    //repeated headers joined by ", ", empty if absent
+    NETWORK_API std::string Header(const std::string& name) const;
 private:
     CURLcode curlCode;
     CURL* curl;
+    STATUS status;
+    long responseCode;
+    std::string responseHeaders;
     bool receivedDlTotal;
     curl_off_t dltotal;
 };
@@ -153,7 +283,7 @@ public:
 private:
     Http::Action* action;
     long long mark;
-    static long long markCouter;
+    static std::atomic<long long> markCouter;
 };
 
 /*HTTP action for response from server, overload do func to perform action to response*/
@@ -162,27 +292,252 @@ public:
     Action(): progressInterval(0.1), lastTime(0) {}
     virtual void Do(const Http::Task& task) = 0;
     virtual int Progress(double totaltime, double dltotal, double dlnow, double ultotal, double ulnow, const Http::Task& task) = 0;
+    //what OnData tells the transfer
+    enum DATA : int {
+        CONTINUE = 0,
+        //stop reading until Router::Resume, data is handed over again then
+        PAUSE = 1,
+        //fail the transfer with CURLE_WRITE_ERROR
+        ABORT = 2
+    };
+    //with RequestOptions::stream, a chunk of the body on the excutor thread. data is
+    //libcurl's buffer, valid during the call only
+    virtual int OnData(const char*, size_t, const Http::Task&) { return CONTINUE; }
     ~Action() {}
-    double ProgressInterval() const { return progressInterval; }
-    void ProgressInterval(double val) { progressInterval = val; }
-    float LastTime() const { return lastTime; }
-    void LastTime(float val) { lastTime = val; }
+    //Progress throttling, an Action wrapping another delegates these to it
+    virtual double ProgressInterval() const { return progressInterval; }
+    virtual void ProgressInterval(double val) { progressInterval = val; }
+    virtual float LastTime() const { return lastTime; }
+    virtual void LastTime(float val) { lastTime = val; }
 private:
     double progressInterval;
     float lastTime;
 };
 
+/*runs Action::Do of finished tasks off the excutor threads, so slow callbacks do not
+  stall transfers. Plug in an application executor through RouterOptions::callbackExecutor*/
+class NETWORK_API CallbackExecutor : public Base {
+public:
+    virtual ~CallbackExecutor() {}
+    //called on excutor threads, must not block: run job once on some other thread
+    virtual void Post(std::function<void()>&& job) = 0;
+};
+
+/*token bucket: requestsPerSecond refill, up to burst requests at once, 0 rate is unlimited*/
+struct HostRateLimit {
+    HostRateLimit(double requestsPerSecond = 0, double burst = 1) : requestsPerSecond(requestsPerSecond), burst(burst) {}
+    double requestsPerSecond;
+    double burst;
+};
+
+/*Router wide cap on retries or hedges, a token bucket: each request earns ratio of a token,
+  minPerSecond tokens come with time, at most burst are kept*/
+struct RetryBudget {
+    RetryBudget(double ratio = 0.1, double minPerSecond = 10, double burst = 100) : ratio(ratio), minPerSecond(minPerSecond), burst(burst) {}
+    double ratio;
+    double minPerSecond;
+    double burst;
+};
+
+/*Router wide configuration. excutorThreads and submissionCapacity are read when the
+  first request starts the excutors, the rest may be changed at any time.
+  Limits are Router wide, each excutor gets its share rounded up, 0 means unlimited*/
+struct RouterOptions {
+    //what Run does once maxQueuedTasks or maxQueuedBytes is reached
+    enum BACKPRESSURE : int {
+        //wait for room
+        BLOCK = 0,
+        //refuse the task, Run returns -1
+        FAIL = 1,
+        //drop the oldest pending task of the lowest class not above the new one's,
+        //refuse the new task if there is none
+        SHED = 2
+    };
+    RouterOptions() : excutorThreads(1), submissionCapacity(4096), easyHandlePoolSize(16),
+        maxConcurrency(9), maxHostConnections(0), maxTotalConnections(0), maxConnects(9),
+        shareConnections(false), multiplex(false), http2PriorKnowledge(false), maxStreams(100),
+        priorityAgingMs(500), hostRateLimit(), hostRateLimits(),
+        connectTimeoutMs(10000), timeoutMs(0), idleTimeoutMs(60000),
+        maxQueuedTasks(0), maxQueuedBytes(0), backpressure(BLOCK),
+        callbackThreads(0), callbackExecutor(nullptr), retry(), retryBudget(),
+        hedge(), hedgeBudget(0.05, 0, 10), coalesceGets(false), cacheBytes(0),
+        diskCachePath(), diskCacheBytes(256 * 1024 * 1024) {}
+    //excutor threads, each drives its own multi handle and steals work from busy peers
+    size_t excutorThreads;
+    //tasks that may wait in each excutor's submission ring before producers spin
+    size_t submissionCapacity;
+    //finished easy handles each excutor keeps for reuse
+    size_t easyHandlePoolSize;
+    //transfers handed to libcurl at the same time
+    size_t maxConcurrency;
+    //CURLMOPT_MAX_HOST_CONNECTIONS, connections to a single host
+    size_t maxHostConnections;
+    //CURLMOPT_MAX_TOTAL_CONNECTIONS, open connections
+    size_t maxTotalConnections;
+    //CURLMOPT_MAXCONNECTS, size of the connection cache
+    size_t maxConnects;
+    //DNS and TLS sessions are always shared between excutors, connections only on request:
+    //needs libcurl 7.57 and libcurl documents it as unsafe across concurrent threads
+    bool shareConnections;
+    //HTTP/2: prefer h2 and multiplex transfers to a host over one connection
+    bool multiplex;
+    //with multiplex, speak h2c without upgrade to plain http:// backends
+    bool http2PriorKnowledge;
+    //with multiplex, CURLMOPT_MAX_CONCURRENT_STREAMS, needs libcurl 7.67
+    size_t maxStreams;
+    //a pending task waiting longer than this is dispatched before higher priority classes
+    long long priorityAgingMs;
+    //pending tasks are served round robin across hosts, each host may be paced by a token bucket
+    HostRateLimit hostRateLimit;
+    //overrides of hostRateLimit keyed by URL::Host()
+    std::map<std::string, HostRateLimit> hostRateLimits;
+    //default deadlines of RequestOptions, 0 is none
+    long long connectTimeoutMs;
+    long long timeoutMs;
+    long long idleTimeoutMs;
+    //accepted tasks not yet handed to libcurl and their approximate heap bytes, 0 is unlimited
+    size_t maxQueuedTasks;
+    size_t maxQueuedBytes;
+    BACKPRESSURE backpressure;
+    //Action::Do runs on the excutor thread by default, with callbackThreads on a pool of
+    //that many threads, with callbackExecutor on it instead. Read with excutorThreads,
+    //callbackExecutor must outlive the Router. Either way Curl() is null in Do
+    size_t callbackThreads;
+    CallbackExecutor* callbackExecutor;
+    //default of RequestOptions::retry, no retries
+    RetryPolicy retry;
+    RetryBudget retryBudget;
+    //default of RequestOptions::hedge, no hedging. hedgeBudget caps hedges like retryBudget
+    //does retries, by default to 5% of the requests
+    HedgePolicy hedge;
+    RetryBudget hedgeBudget;
+    //a Get equal by URL::operator== to one pending or in flight shares its transfer and
+    //Response, under the options of the first. Cancelling one of them cancels it alone
+    bool coalesceGets;
+    //bound of the in-memory LRU cache of GET responses, 0 is no cache. Fresh entries by
+    //Cache-Control max-age or Expires are served without a transfer, Action::Do running
+    //before Get returns unless a callback executor is set; stale ones are revalidated
+    //with If-None-Match/If-Modified-Since and a 304 lends the cached body, see Memory::Borrow
+    size_t cacheBytes;
+    //directory of a persistent cache behind the in-memory one, empty is none. It outlives
+    //the process, only its index is read at startup, and hits lend a read-only mapped view
+    //of the file. Responses are written to it on the thread running Action::Do
+    std::string diskCachePath;
+    //size of a cache file, a full one is replaced by a new empty one
+    size_t diskCacheBytes;
+};
+
+/*Router wide counters, a snapshot summed over all excutors*/
+struct RouterStats {
+    RouterStats() : easyHandlesCreated(0), easyHandlesReused(0), queuedTasks(0), queuedBytes(0),
+        tasksShed(0), tasksRejected(0), retries(0), retriesDenied(0),
+        hedges(0), hedgesWon(0), coalesced(0), cacheHits(0), cacheMisses(0), cacheRevalidated(0),
+        cacheDiskHits(0) {
+        for (int i = 0; i < RequestOptions::PRIORITY_COUNT; ++i) {
+            dispatched[i] = 0;
+            queueWaitUs[i] = 0;
+            maxQueueWaitUs[i] = 0;
+        }
+    }
+    size_t easyHandlesCreated;
+    size_t easyHandlesReused;
+    //per priority: tasks handed to libcurl, their summed and longest wait in the pending queue
+    unsigned long long dispatched[RequestOptions::PRIORITY_COUNT];
+    unsigned long long queueWaitUs[RequestOptions::PRIORITY_COUNT];
+    unsigned long long maxQueueWaitUs[RequestOptions::PRIORITY_COUNT];
+    //queue depth: accepted tasks not yet handed to libcurl and their approximate bytes
+    size_t queuedTasks;
+    size_t queuedBytes;
+    //tasks dropped for RouterOptions::SHED and submissions refused for lack of room
+    unsigned long long tasksShed;
+    unsigned long long tasksRejected;
+    //retries made and retryable failures given up for lack of retryBudget
+    unsigned long long retries;
+    unsigned long long retriesDenied;
+    //second transfers sent by RequestOptions::hedge and those finishing first
+    unsigned long long hedges;
+    unsigned long long hedgesWon;
+    //requests served by the transfer of an identical one, see RouterOptions::coalesceGets
+    unsigned long long coalesced;
+    //RouterOptions::cacheBytes: fresh hits, lookups going to the network, 304s reusing an entry
+    unsigned long long cacheHits;
+    unsigned long long cacheMisses;
+    unsigned long long cacheRevalidated;
+    //of those served or revalidated, the ones found in RouterOptions::diskCachePath
+    unsigned long long cacheDiskHits;
+};
+
+class Excutor;
+class ShareCache;
+class Admission;
+class Coalescer;
+class ResponseCache;
+class Segmenter;
 class  Router : public Base {
 public:
     NETWORK_API static  Router& GetInstance();
-    NETWORK_API void Get(const URL& url, Action* httpAction, Base* userData = nullptr);
-    NETWORK_API void Post(const URL& url, const std::vector<UploadedData>& uploadedDatas, Action* httpAction, Base* userData = nullptr);
-    NETWORK_API void Run(Task&& task);
+    //returns the Task::Mark of the submitted task, the handle for Cancel,
+    //or -1 if a full queue refused it, see RouterOptions::backpressure
+    NETWORK_API long long Get(const URL& url, Action* httpAction, Base* userData = nullptr, const RequestOptions& options = RequestOptions());
+    NETWORK_API long long Post(const URL& url, const std::vector<UploadedData>& uploadedDatas, Action* httpAction, Base* userData = nullptr, const RequestOptions& options = RequestOptions());
+    NETWORK_API long long Run(Task&& task);
+    //never wait for room: with RouterOptions::BLOCK these fail like FAIL, -1 means refused.
+    //Use them from Action callbacks, blocking an excutor thread may wait on itself
+    NETWORK_API long long TryGet(const URL& url, Action* httpAction, Base* userData = nullptr, const RequestOptions& options = RequestOptions());
+    NETWORK_API long long TryPost(const URL& url, const std::vector<UploadedData>& uploadedDatas, Action* httpAction, Base* userData = nullptr, const RequestOptions& options = RequestOptions());
+    NETWORK_API long long TryRun(Task&& task);
+    //GET url straight into the file at path, replacing it. The body is written as it
+    //arrives on the excutor thread, Do gets an empty body once the file is complete.
+    //A failed transfer, an error status or a failed write removes the file, the latter
+    //is reported as CURLE_WRITE_ERROR. options.stream is implied. Cancel with the returned
+    //mark stops every range of a segmented download
+    NETWORK_API long long Download(const URL& url, const std::string& path, Action* httpAction, Base* userData = nullptr,
+                                   const RequestOptions& options = RequestOptions(), const DownloadOptions& download = DownloadOptions());
+    //GET every url with one queue operation and one wakeup. The future holds a Response per
+    //url, in order, once needed of them ended (0 is all); the others are cancelled then and
+    //reported as Response::CANCELLED, those refused by a full queue as Response::DROPPED
+    NETWORK_API std::future<std::vector<Response> > GetAll(const std::vector<URL>& urls, size_t needed = 0, const RequestOptions& options = RequestOptions());
+    //drop a pending task or abort an in-flight one, its Action gets Response::CANCELLED.
+    //Unknown or finished marks are ignored
+    NETWORK_API void Cancel(long long mark);
+    //continue a transfer paused by Action::OnData. Unknown or finished marks are ignored
+    NETWORK_API void Resume(long long mark);
+    //a copy, Options may be replaced from any thread at any time
+    NETWORK_API RouterOptions Options() const;
+    NETWORK_API void Options(const RouterOptions& val);
+    NETWORK_API RouterStats Stats() const;
     NETWORK_API ~Router();
     NETWORK_API Router(const Router& http) = delete;
     NETWORK_API Router& operator=(const Router&) = delete;
 private:
-    Router() {}
+    Router();
+    //create and start the excutors once
+    void Start();
+    long long Submit(Task&& task, bool block);
+    //make room for task by options.backpressure
+    bool Admit(Task& task, bool block, const RouterOptions& options);
+    //drop the oldest pending task of the lowest class at or below priority over all excutors
+    bool Shed(int priority);
+    //run the action of a task served without an excutor and free it
+    void Deliver(Task* task);
+    //the options in force, an immutable snapshot
+    std::shared_ptr<const RouterOptions> Current() const;
+    //the started excutors, none before Start
+    const std::vector<Excutor*>& Excutors() const;
+private:
+    //replaced whole under optionsMutex, read with std::atomic_load
+    std::shared_ptr<const RouterOptions> options;
+    std::mutex optionsMutex;
+    //heap owned, published complete by Start. Detached excutors keep using it while the process exits
+    std::atomic<std::vector<Excutor*>*> excutors;
+    //round robin cursor spreading tasks over excutors
+    std::atomic<size_t> nextExcutor;
+    ShareCache* share;
+    Admission* admission;
+    Coalescer* coalescer;
+    ResponseCache* cache;
+    Segmenter* segmenter;
+    CallbackExecutor* callbacks;
 };
 
 }
@@ -35,6 +35,10 @@ public:
     NETWORK_API bool operator==(const URL& url)const;
     NETWORK_API const std::string& ToString()const;
     NETWORK_API const AttribMap& GetAttribMap()const;
+    // host[:port] the request goes to, lower cased
+    NETWORK_API std::string Host()const;
+    // one spelling per request target, a cache key
+    NETWORK_API std::string Canonical()const;
     NETWORK_API void Escape(CURL* eh);
     NETWORK_API virtual ~URL();
 private: